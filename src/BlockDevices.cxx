@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "BlockDevices.hxx"
+
+#include <fmt/format.h>
+
+#include <unistd.h> // for readlink()
+
+using std::string_view_literals::operator""sv;
+
+static std::string
+LookupBlockDeviceName(unsigned major, unsigned minor)
+{
+	char path[64];
+	*fmt::format_to_n(path, sizeof(path) - 1, "/sys/dev/block/{}:{}"sv,
+			  major, minor).out = 0;
+
+	/* the symlink points to the device's directory in
+	   /sys/devices, e.g. "../../devices/.../block/sda/sda1" */
+	char target[1024];
+	const ssize_t length = readlink(path, target, sizeof(target));
+	if (length > 0) {
+		std::string_view s{target, static_cast<std::size_t>(length)};
+		if (const auto slash = s.rfind('/'); slash != s.npos)
+			s = s.substr(slash + 1);
+
+		if (!s.empty())
+			return std::string{s};
+	}
+
+	return fmt::format("{}:{}"sv, major, minor);
+}
+
+std::string_view
+BlockDeviceNames::Get(unsigned major, unsigned minor)
+{
+	const uint_least64_t key = (uint_least64_t{major} << 32) | minor;
+
+	const std::scoped_lock lock{mutex};
+
+	auto [i, inserted] = map.try_emplace(key);
+	if (inserted)
+		i->second = LookupBlockDeviceName(major, minor);
+
+	return i->second;
+}
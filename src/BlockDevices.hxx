@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Resolves block device numbers ("major:minor" as found in
+ * "io.stat") to kernel device names (e.g. "sda") via
+ * /sys/dev/block.  Results are cached forever; a device number
+ * which is reused for another device after a hotplug event will
+ * show the old name until the exporter restarts.
+ *
+ * This class is thread-safe.
+ */
+class BlockDeviceNames {
+	std::mutex mutex;
+
+	/**
+	 * Key is major<<32|minor.  Elements are never erased,
+	 * therefore references to the names remain valid.
+	 */
+	std::unordered_map<uint_least64_t, std::string> map;
+
+public:
+	/**
+	 * @return the device name or "major:minor" if it could not
+	 * be determined
+	 */
+	std::string_view Get(unsigned major, unsigned minor);
+};
@@ -3,6 +3,8 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "CephDebugfs.hxx"
+#include "CephLatency.hxx"
+#include "CephOsdc.hxx"
 #include "NumberParser.hxx"
 #include "io/BufferedOutputStream.hxx"
 #include "io/BufferedReader.hxx"
@@ -10,6 +12,7 @@
 #include "io/DirectoryReader.hxx"
 #include "io/Open.hxx"
 #include "io/SmallTextFile.hxx"
+#include "io/StringOutputStream.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/IterableSplitString.hxx"
 #include "util/NumberParser.hxx"
@@ -18,9 +21,16 @@
 #include "util/StringCompare.hxx"
 #include "util/StringSplit.hxx"
 
+#include <algorithm>
 #include <array>
+#include <condition_variable>
 #include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <fcntl.h>
 
@@ -28,6 +38,21 @@ using std::string_view_literals::operator""sv;
 
 static constexpr std::size_t CEPH_MAX_MDS = 0x400;
 
+/**
+ * State carried over from previous scrapes.  It is
+ * reference-counted because stuck workers may outlive the
+ * #CephCollector.
+ */
+struct CephHistory {
+	CephLatencyHistory latency;
+	CephOsdcHistory osdc;
+
+	void Expire() noexcept {
+		latency.Expire();
+		osdc.Expire();
+	}
+};
+
 static inline auto
 ParseNS(std::string_view text) noexcept
 {
@@ -197,27 +222,107 @@ static constexpr std::array ceph_mds_ops{
 	"getfilelock"sv,
 };
 
-static std::size_t
+/**
+ * The size of the #mds_op_hash_table; larger than necessary so a
+ * perfect hash seed can be found quickly at compile time.
+ */
+static constexpr std::size_t MDS_OP_HASH_SIZE = 128;
+
+/**
+ * A FNV-1a variant for MDS operation names.
+ */
+static constexpr std::size_t
+HashMdsOpName(std::string_view s, uint_least64_t seed) noexcept
+{
+	uint_least64_t h = seed;
+	for (const char ch : s) {
+		h ^= static_cast<unsigned char>(ch);
+		h *= 0x100000001b3;
+	}
+
+	return static_cast<std::size_t>((h ^ (h >> 32)) % MDS_OP_HASH_SIZE);
+}
+
+static constexpr bool
+IsPerfectMdsOpHashSeed(uint_least64_t seed) noexcept
+{
+	std::array<bool, MDS_OP_HASH_SIZE> used{};
+	for (const auto op : ceph_mds_ops) {
+		auto &u = used[HashMdsOpName(op, seed)];
+		if (u)
+			return false;
+		u = true;
+	}
+
+	return true;
+}
+
+static constexpr uint_least64_t
+FindMdsOpHashSeed() noexcept
+{
+	uint_least64_t seed = 0;
+	while (!IsPerfectMdsOpHashSeed(seed))
+		++seed;
+	return seed;
+}
+
+static constexpr uint_least64_t mds_op_hash_seed = FindMdsOpHashSeed();
+
+/**
+ * Maps a hash value to an index into #ceph_mds_ops; unused slots
+ * contain ceph_mds_ops.size().
+ */
+static constexpr auto mds_op_hash_table = []{
+	std::array<uint_least8_t, MDS_OP_HASH_SIZE> table;
+	table.fill(ceph_mds_ops.size());
+
+	for (std::size_t i = 0; i < ceph_mds_ops.size(); ++i)
+		table[HashMdsOpName(ceph_mds_ops[i], mds_op_hash_seed)] = i;
+
+	return table;
+}();
+
+/**
+ * @return an index into #ceph_mds_ops or ceph_mds_ops.size() if the
+ * name is unknown
+ */
+[[gnu::pure]]
+static constexpr std::size_t
 ParseMdsOpName(std::string_view s) noexcept
 {
-	const auto it = std::find(ceph_mds_ops.begin(), ceph_mds_ops.end(), s);
-	return std::distance(ceph_mds_ops.begin(), it);
+	const std::size_t i = mds_op_hash_table[HashMdsOpName(s, mds_op_hash_seed)];
+	if (i < ceph_mds_ops.size() && ceph_mds_ops[i] == s)
+		return i;
+
+	return ceph_mds_ops.size();
 }
 
+static_assert(ParseMdsOpName("lookup"sv) == 0);
+static_assert(ParseMdsOpName("getfilelock"sv) == ceph_mds_ops.size() - 1);
+static_assert(ParseMdsOpName("foo"sv) == ceph_mds_ops.size());
+
 struct CephMdsc {
 	struct PerOp {
 		uint64_t count;
 	};
 
 	struct PerMds {
-		std::array<PerOp, std::size(ceph_mds_ops) + 1> per_op;
+		std::array<PerOp, std::size(ceph_mds_ops) + 1> per_op{};
 	};
 
-	static constexpr std::size_t UNKNOWN_MDS = CEPH_MAX_MDS;
-	static constexpr std::size_t NO_REQUEST = UNKNOWN_MDS + 1;
-	static constexpr std::size_t NO_SESSION = NO_REQUEST + 1;
+	/**
+	 * Indexed by the MDS rank; only as large as the highest rank
+	 * that was seen in the "mdsc" file.
+	 */
+	std::vector<PerMds> per_rank;
+
+	PerMds unknown_mds, no_request, no_session;
 
-	std::array<PerMds, CEPH_MAX_MDS + 3> per_mds{};
+	PerMds &MakeRank(std::size_t rank) noexcept {
+		if (rank >= per_rank.size())
+			per_rank.resize(rank + 1);
+		return per_rank[rank];
+	}
 };
 
 static void
@@ -229,21 +334,24 @@ LoadMdsc(BufferedReader &r, CephMdsc &result)
 		const auto [mds_name, rest2] = Split(rest1, '\t');
 		const auto [op_name, rest3] = Split(rest2, '\t');
 
-		std::size_t mds_rank;
+		CephMdsc::PerMds *per_mds;
 		if (const auto mds_rank_s = StringAfterPrefix(mds_name, "mds"sv);
 		    !mds_rank_s.empty()) {
-			if (!ParseIntegerTo(mds_rank_s, mds_rank) || mds_rank >= CEPH_MAX_MDS)
-				mds_rank = CephMdsc::UNKNOWN_MDS;
+			std::size_t mds_rank;
+			if (ParseIntegerTo(mds_rank_s, mds_rank) && mds_rank < CEPH_MAX_MDS)
+				per_mds = &result.MakeRank(mds_rank);
+			else
+				per_mds = &result.unknown_mds;
 		} else if (mds_name == "(no request)"sv)
-			mds_rank = CephMdsc::NO_REQUEST;
+			per_mds = &result.no_request;
 		else if (mds_name == "(no session)"sv)
-			mds_rank = CephMdsc::NO_SESSION;
+			per_mds = &result.no_session;
 		else
-			mds_rank = CephMdsc::UNKNOWN_MDS;
+			per_mds = &result.unknown_mds;
 
-		std::size_t op = ParseMdsOpName(op_name);
+		const std::size_t op = ParseMdsOpName(op_name);
 
-		++result.per_mds[mds_rank].per_op[op].count;
+		++per_mds->per_op[op].count;
 	}
 }
 
@@ -261,6 +369,31 @@ LoadMdsc(FileAt file, CephMdsc &result)
 	return true;
 }
 
+static void
+ExportMdsc(BufferedOutputStream &os, std::string_view fsid, std::string_view name,
+	   std::string_view mds, std::string_view mds_address,
+	   const CephMdsc::PerMds &per_mds)
+{
+	for (std::size_t op = 0; op < per_mds.per_op.size(); ++op) {
+		const auto &per_op = per_mds.per_op[op];
+		if (per_op.count == 0)
+			continue;
+
+		const std::string_view op_name = op < ceph_mds_ops.size()
+			? ceph_mds_ops[op]
+			: "unknown"sv;
+
+		os.Fmt("ceph_mds_pending_requests{{fsid={:?},name={:?},mds={:?}"sv,
+		       fsid, name, mds);
+
+		if (!mds_address.empty())
+			os.Fmt(",address={:?}"sv, mds_address);
+
+		os.Fmt(",op={:?}}} {}\n",
+		       op_name, per_op.count);
+	}
+}
+
 static void
 ExportCephSize(BufferedOutputStream &os, std::string_view fsid, std::string_view name,
 	       std::string_view contents)
@@ -365,8 +498,294 @@ ExportCephCounters(BufferedOutputStream &os, std::string_view fsid, std::string_
 	}
 }
 
+/**
+ * Export all metrics of one Ceph mount.
+ *
+ * @param subdir the "/sys/kernel/debug/ceph/<fsid>.<client>"
+ * directory
+ * @param mount the directory name ("<fsid>.<client>")
+ */
+static void
+ExportCephMount(BufferedOutputStream &os, FileDescriptor subdir,
+		std::string_view mount, CephHistory &history)
+{
+	const auto fsid = Split(mount, '.').first;
+
+	CephMds mds_sessions;
+
+	try {
+		LoadStatus(mds_sessions, FileAt{subdir, "status"});
+	} catch (...) {
+		PrintException(std::current_exception());
+	}
+
+	try {
+		LoadMdsMap(mds_sessions, FileAt{subdir, "mdsmap"});
+	} catch (...) {
+		PrintException(std::current_exception());
+	}
+
+	try {
+		LoadMdsSessions(mds_sessions, FileAt{subdir, "mds_sessions"});
+	} catch (...) {
+		PrintException(std::current_exception());
+	}
+
+	const std::string_view name = mds_sessions.name;
+
+	os.Fmt("ceph_client_blocklisted{{fsid={:?},name={:?}"sv, fsid, name);
+
+	if (!mds_sessions.global_id.empty())
+		os.Fmt(",global_id={:?}"sv, mds_sessions.global_id);
+
+	os.Fmt("}} {}\n"sv, mds_sessions.blocklisted ? "1"sv : "0"sv);
+
+	for (std::size_t id = 0; id < mds_sessions.list.size(); ++id) {
+		const auto &mds = mds_sessions.list[id];
+		if (!mds.IsDefined())
+			continue;
+
+		os.Fmt("ceph_mds{{fsid={:?},name={:?},mds=\"{}\""sv, fsid, name, id);
+
+		if (!mds.protocol.empty())
+			os.Fmt(",protocol={:?}"sv, mds.protocol);
+
+		if (!mds.address.empty())
+			os.Fmt(",address={:?}"sv, mds.address);
+
+		if (!mds.state.empty())
+			os.Fmt(",state={:?}"sv, mds.state);
+
+		if (!mds.session_state.empty())
+			os.Fmt(",session_state={:?}"sv, mds.session_state);
+
+		os.Write("} 1\n"sv);
+	}
+
+	if (CephMdsc mdsc; LoadMdsc({subdir, "mdsc"}, mdsc)) {
+		for (std::size_t rank = 0; rank < mdsc.per_rank.size(); ++rank) {
+			std::string_view mds_address;
+
+			if (rank < mds_sessions.list.size()) {
+				const auto &mds = mds_sessions.list[rank];
+				if (mds.IsDefined())
+					mds_address = mds.address;
+			}
+
+			char mds_buffer[16];
+			const std::string_view mds_label{
+				mds_buffer,
+				fmt::format_to(mds_buffer, "{}"sv, rank),
+			};
+
+			ExportMdsc(os, fsid, name, mds_label, mds_address,
+				   mdsc.per_rank[rank]);
+		}
+
+		ExportMdsc(os, fsid, name, "unknown"sv, {}, mdsc.unknown_mds);
+		ExportMdsc(os, fsid, name, "no_request"sv, {}, mdsc.no_request);
+		ExportMdsc(os, fsid, name, "no_session"sv, {}, mdsc.no_session);
+	}
+
+	ExportCephOsdc(os, fsid, name, mount, subdir, history.osdc);
+
+	UniqueFileDescriptor f;
+	if (f.OpenReadOnly({subdir, "metrics/size"})) {
+		WithSmallTextFile<4096>(f, [&os, fsid, name](std::string_view contents){
+			ExportCephSize(os, fsid, name, contents);
+		});
+
+		f.Close();
+	}
+
+	if (f.OpenReadOnly({subdir, "metrics/caps"})) {
+		WithSmallTextFile<4096>(f, [&os, fsid, name](std::string_view contents){
+			ExportCephCaps(os, fsid, name, contents);
+		});
+
+		f.Close();
+	}
+
+	if (f.OpenReadOnly({subdir, "metrics/counters"})) {
+		WithSmallTextFile<4096>(f, [&os, fsid, name](std::string_view contents){
+			ExportCephCounters(os, fsid, name, contents);
+		});
+
+		f.Close();
+	}
+
+	if (f.OpenReadOnly({subdir, "metrics/latency"})) {
+		WithSmallTextFile<4096>(f, [&](std::string_view contents){
+			ExportCephLatency(os, fsid, name, mount, contents,
+					  history.latency);
+		});
+
+		f.Close();
+	}
+}
+
+/**
+ * Render the metrics of one Ceph mount into a string.
+ */
+static std::string
+CollectCephMount(FileDescriptor subdir, std::string_view mount,
+		 CephHistory &history)
+{
+	StringOutputStream sos;
+	BufferedOutputStream bos(sos);
+	ExportCephMount(bos, subdir, mount, history);
+	bos.Flush();
+	return sos.GetValue();
+}
+
+struct CephCollector::Job {
+	/**
+	 * The directory name ("<fsid>.<client>").
+	 */
+	const std::string filename;
+
+	const UniqueFileDescriptor directory;
+
+	/**
+	 * A reference to the #CephCollector's history which keeps it
+	 * alive while this job is stuck.
+	 */
+	const std::shared_ptr<CephHistory> history;
+
+	std::chrono::steady_clock::time_point start_time;
+
+	std::string output;
+
+	enum class State {
+		QUEUED,
+		RUNNING,
+		DONE,
+
+		/**
+		 * The deadline has expired and the job has been
+		 * abandoned by the scraper.  If it is still running,
+		 * its worker thread is stuck in the kernel.
+		 */
+		TIMEOUT,
+	} state = State::QUEUED;
+
+	Job(std::string_view _filename,
+	    UniqueFileDescriptor &&_directory,
+	    std::shared_ptr<CephHistory> _history) noexcept
+		:filename(_filename), directory(std::move(_directory)),
+		 history(std::move(_history)) {}
+
+	std::string_view GetFsid() const noexcept {
+		return Split(std::string_view{filename}, '.').first;
+	}
+
+	std::string_view GetClient() const noexcept {
+		return Split(std::string_view{filename}, '.').second;
+	}
+};
+
+/**
+ * The state shared by the scraper and all worker threads.  It is
+ * reference-counted because stuck workers may outlive the
+ * #CephCollector.
+ */
+struct CephCollector::Pool {
+	std::mutex mutex;
+
+	/**
+	 * Signalled when a new job has been queued.
+	 */
+	std::condition_variable queue_cond;
+
+	/**
+	 * Signalled when a job has been finished.
+	 */
+	std::condition_variable done_cond;
+
+	std::deque<std::shared_ptr<Job>> queue;
+
+	/**
+	 * The directory names of mounts whose job from an earlier
+	 * scrape is still stuck.  No new jobs are submitted for
+	 * these until the old one returns.
+	 */
+	std::set<std::string, std::less<>> stuck;
+
+	void Run() noexcept;
+};
+
+void
+CephCollector::Pool::Run() noexcept
+{
+	std::unique_lock lock{mutex};
+
+	while (true) {
+		queue_cond.wait(lock, [this]{ return !queue.empty(); });
+
+		auto job = std::move(queue.front());
+		queue.pop_front();
+
+		job->state = Job::State::RUNNING;
+		job->start_time = std::chrono::steady_clock::now();
+
+		lock.unlock();
+
+		std::string output;
+		try {
+			output = CollectCephMount(job->directory, job->filename,
+						  *job->history);
+		} catch (...) {
+			PrintException(std::current_exception());
+		}
+
+		lock.lock();
+
+		if (job->state == Job::State::TIMEOUT) {
+			/* too late, the scraper has given up on this
+			   one */
+			stuck.erase(job->filename);
+		} else {
+			job->output = std::move(output);
+			job->state = Job::State::DONE;
+			done_cond.notify_all();
+		}
+	}
+}
+
+CephCollector::CephCollector(unsigned n_workers,
+			     std::chrono::steady_clock::duration _timeout) noexcept
+	:history(std::make_shared<CephHistory>()),
+	 timeout(_timeout)
+{
+	if (n_workers == 0)
+		return;
+
+	pool = std::make_shared<Pool>();
+
+	unsigned n_started = 0;
+
+	try {
+		for (; n_started < n_workers; ++n_started)
+			/* the threads are detached because stuck
+			   workers cannot be joined */
+			std::thread{[p = pool]{ p->Run(); }}.detach();
+	} catch (...) {
+		/* probably limited by "TasksMax" */
+		PrintException(std::current_exception());
+
+		/* if no worker could be started, collect
+		   sequentially; otherwise, keep using the workers
+		   which are already running (they hold a reference
+		   to the pool and would wait for jobs forever) */
+		if (n_started == 0)
+			pool.reset();
+	}
+}
+
+CephCollector::~CephCollector() noexcept = default;
+
 void
-ExportCeph(BufferedOutputStream &os)
+CephCollector::Export(BufferedOutputStream &os)
 {
 	os.Write(R"(
 # HELP ceph_client_blocklisted Is this Ceph client blocklisted?
@@ -375,6 +794,10 @@ ExportCeph(BufferedOutputStream &os)
 # TYPE ceph_mds gauge
 # HELP ceph_mds_pending_requests Number of pending MDS requests
 # TYPE ceph_mds_pending_requests gauge
+# HELP ceph_osd_pending_requests Number of pending OSD requests
+# TYPE ceph_osd_pending_requests gauge
+# HELP ceph_osd_oldest_request_age_seconds Estimated age of the oldest pending OSD request (a lower bound)
+# TYPE ceph_osd_oldest_request_age_seconds gauge
 # HELP ceph_metrics_size_bytes Bytes transferred to/from a Ceph server
 # TYPE ceph_metrics_size_bytes counter
 # HELP ceph_metrics_size_count Number of operations to/from a Ceph server
@@ -391,147 +814,129 @@ ExportCeph(BufferedOutputStream &os)
 # TYPE ceph_metrics_size counter
 # HELP ceph_metrics_wait Total number of seconds waited on this Ceph mount
 # TYPE ceph_metrics_wait counter
+# HELP ceph_metrics_latency_seconds Latency of Ceph operations; the quantiles are calculated from the average latency between recent scrapes
+# TYPE ceph_metrics_latency_seconds summary
+# HELP ceph_metrics_latency_min_seconds Minimum latency of Ceph operations
+# TYPE ceph_metrics_latency_min_seconds gauge
+# HELP ceph_metrics_latency_max_seconds Maximum latency of Ceph operations
+# TYPE ceph_metrics_latency_max_seconds gauge
+# HELP ceph_metrics_latency_stdev_seconds Standard deviation of the latency of Ceph operations
+# TYPE ceph_metrics_latency_stdev_seconds gauge
+# HELP ceph_collect_timeout Did collecting this Ceph mount time out?
+# TYPE ceph_collect_timeout gauge
 )");
 
+	history->Expire();
+
 	UniqueFileDescriptor d;
 	if (!d.Open("/sys/kernel/debug/ceph", O_DIRECTORY|O_RDONLY))
 		return;
 
 	DirectoryReader dr{std::move(d)};
-	while (auto filename = dr.Read()) {
-		const auto fsid = Split(std::string_view{filename}, '.').first;
-		if (fsid.empty())
-			continue;
-
-		UniqueFileDescriptor subdir;
-		if (!subdir.Open({dr.GetFileDescriptor(), filename}, O_DIRECTORY|O_PATH))
-			continue;
-
-		CephMds mds_sessions;
-
-		try {
-			LoadStatus(mds_sessions, FileAt{subdir, "status"});
-		} catch (...) {
-			PrintException(std::current_exception());
-		}
-
-		try {
-			LoadMdsMap(mds_sessions, FileAt{subdir, "mdsmap"});
-		} catch (...) {
-			PrintException(std::current_exception());
-		}
-
-		try {
-			LoadMdsSessions(mds_sessions, FileAt{subdir, "mds_sessions"});
-		} catch (...) {
-			PrintException(std::current_exception());
-		}
-
-		const std::string_view name = mds_sessions.name;
-
-		os.Fmt("ceph_client_blocklisted{{fsid={:?},name={:?}"sv, fsid, name);
 
-		if (!mds_sessions.global_id.empty())
-			os.Fmt(",global_id={:?}"sv, mds_sessions.global_id);
-
-		os.Fmt("}} {}\n"sv, mds_sessions.blocklisted ? "1"sv : "0"sv);
+	if (!pool) {
+		while (auto filename = dr.Read()) {
+			const auto fsid = Split(std::string_view{filename}, '.').first;
+			if (fsid.empty())
+				continue;
 
-		for (std::size_t id = 0; id < mds_sessions.list.size(); ++id) {
-			const auto &mds = mds_sessions.list[id];
-			if (!mds.IsDefined())
+			UniqueFileDescriptor subdir;
+			if (!subdir.Open({dr.GetFileDescriptor(), filename}, O_DIRECTORY|O_PATH))
 				continue;
 
-			os.Fmt("ceph_mds{{fsid={:?},name={:?},mds=\"{}\""sv, fsid, name, id);
+			ExportCephMount(os, subdir, filename, *history);
+		}
 
-			if (!mds.protocol.empty())
-				os.Fmt(",protocol={:?}"sv, mds.protocol);
+		return;
+	}
 
-			if (!mds.address.empty())
-				os.Fmt(",address={:?}"sv, mds.address);
+	std::vector<std::shared_ptr<Job>> jobs;
+	std::vector<std::string> skipped;
 
-			if (!mds.state.empty())
-				os.Fmt(",state={:?}"sv, mds.state);
+	std::unique_lock lock{pool->mutex};
 
-			if (!mds.session_state.empty())
-				os.Fmt(",session_state={:?}"sv, mds.session_state);
+	while (auto filename = dr.Read()) {
+		const auto fsid = Split(std::string_view{filename}, '.').first;
+		if (fsid.empty())
+			continue;
 
-			os.Write("} 1\n"sv);
+		if (pool->stuck.contains(std::string_view{filename})) {
+			skipped.emplace_back(filename);
+			continue;
 		}
 
-		if (CephMdsc mdsc; LoadMdsc({subdir, "mdsc"}, mdsc)) {
-			for (std::size_t rank = 0; rank < mds_sessions.list.size(); ++rank) {
-				const auto &mdsc_rank = mdsc.per_mds[rank];
+		UniqueFileDescriptor subdir;
+		if (!subdir.Open({dr.GetFileDescriptor(), filename}, O_DIRECTORY|O_PATH))
+			continue;
 
-				std::string_view mds_address;
+		auto job = std::make_shared<Job>(filename, std::move(subdir),
+						 history);
+		pool->queue.push_back(job);
+		jobs.emplace_back(std::move(job));
+	}
 
-				if (rank < mds_sessions.list.size()) {
-					const auto &mds = mds_sessions.list[rank];
-					if (mds.IsDefined())
-						mds_address = mds.address;
+	pool->queue_cond.notify_all();
+
+	/* jobs which have not been started by then (because all
+	   workers are busy or stuck) are given up */
+	const auto queue_deadline = std::chrono::steady_clock::now() + timeout;
+
+	while (true) {
+		const auto now = std::chrono::steady_clock::now();
+		auto next_deadline = std::chrono::steady_clock::time_point::max();
+		bool pending = false;
+
+		for (auto &job : jobs) {
+			switch (job->state) {
+			case Job::State::QUEUED:
+				if (now >= queue_deadline) {
+					std::erase(pool->queue, job);
+					job->state = Job::State::TIMEOUT;
+				} else {
+					pending = true;
+					next_deadline = std::min(next_deadline, queue_deadline);
 				}
 
-				for (std::size_t op = 0; op < mdsc_rank.per_op.size(); ++op) {
-					const auto &per_op = mdsc_rank.per_op[op];
-					if (per_op.count == 0)
-						continue;
-
-					const std::string_view op_name = op < ceph_mds_ops.size()
-						? ceph_mds_ops[op]
-						: "unknown"sv;
-
-					os.Fmt("ceph_mds_pending_requests{{fsid={:?},name={:?}"sv,
-					       fsid, name);
-
-					switch (rank) {
-					case CephMdsc::UNKNOWN_MDS:
-						os.Write(",mds=\"unkown\""sv);
-						break;
+				break;
 
-					case CephMdsc::NO_REQUEST:
-						os.Write(",mds=\"no_request\""sv);
-						break;
-
-					case CephMdsc::NO_SESSION:
-						os.Write(",mds=\"no_session\""sv);
-						break;
-
-					default:
-						os.Fmt(",mds=\"{}\""sv, rank);
-						break;
-					}
+			case Job::State::RUNNING:
+				if (const auto deadline = job->start_time + timeout;
+				    now >= deadline) {
+					job->state = Job::State::TIMEOUT;
+					pool->stuck.emplace(job->filename);
+				} else {
+					pending = true;
+					next_deadline = std::min(next_deadline, deadline);
+				}
 
-					if (!mds_address.empty())
-						os.Fmt(",address={:?}"sv, mds_address);
+				break;
 
-					os.Fmt(",op={:?}}} {}\n",
-					       op_name, per_op.count);
-				}
+			case Job::State::DONE:
+			case Job::State::TIMEOUT:
+				break;
 			}
 		}
 
-		UniqueFileDescriptor f;
-		if (f.OpenReadOnly({subdir, "metrics/size"})) {
-			WithSmallTextFile<4096>(f, [&os, fsid, name](std::string_view contents){
-				ExportCephSize(os, fsid, name, contents);
-			});
+		if (!pending)
+			break;
 
-			f.Close();
-		}
+		pool->done_cond.wait_until(lock, next_deadline);
+	}
 
-		if (f.OpenReadOnly({subdir, "metrics/caps"})) {
-			WithSmallTextFile<4096>(f, [&os, fsid, name](std::string_view contents){
-				ExportCephCaps(os, fsid, name, contents);
-			});
+	lock.unlock();
 
-			f.Close();
-		}
+	for (const auto &job : jobs) {
+		const bool timed_out = job->state == Job::State::TIMEOUT;
+		if (!timed_out)
+			os.Write(std::string_view{job->output});
 
-		if (f.OpenReadOnly({subdir, "metrics/counters"})) {
-			WithSmallTextFile<4096>(f, [&os, fsid, name](std::string_view contents){
-				ExportCephCounters(os, fsid, name, contents);
-			});
+		os.Fmt("ceph_collect_timeout{{fsid={:?},client={:?}}} {}\n",
+		       job->GetFsid(), job->GetClient(), timed_out ? 1 : 0);
+	}
 
-			f.Close();
-		}
+	for (const std::string_view filename : skipped) {
+		const auto [fsid, client] = Split(filename, '.');
+		os.Fmt("ceph_collect_timeout{{fsid={:?},client={:?}}} 1\n",
+		       fsid, client);
 	}
 }
@@ -4,7 +4,49 @@
 
 #pragma once
 
+#include <chrono>
+#include <memory>
+
 class BufferedOutputStream;
+struct CephHistory;
+
+/**
+ * Collects metrics from /sys/kernel/debug/ceph.  Optionally, the
+ * mounts are collected in parallel by a pool of worker threads, each
+ * with a deadline, so a stuck Ceph client cannot stall the whole
+ * exporter.
+ */
+class CephCollector {
+	struct Job;
+	struct Pool;
+
+	/**
+	 * The worker pool; nullptr if mounts are collected
+	 * sequentially.
+	 */
+	std::shared_ptr<Pool> pool;
+
+	/**
+	 * State carried over from previous scrapes.
+	 */
+	const std::shared_ptr<CephHistory> history;
+
+	const std::chrono::steady_clock::duration timeout;
+
+public:
+	/**
+	 * @param n_workers the number of worker threads; 0 means
+	 * collect sequentially in the calling thread (without a
+	 * deadline)
+	 * @param timeout the deadline for collecting one mount
+	 */
+	CephCollector(unsigned n_workers,
+		      std::chrono::steady_clock::duration timeout) noexcept;
+
+	~CephCollector() noexcept;
+
+	CephCollector(const CephCollector &) = delete;
+	CephCollector &operator=(const CephCollector &) = delete;
 
-void
-ExportCeph(BufferedOutputStream &os);
+	void Export(BufferedOutputStream &os);
+};
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "CephLatency.hxx"
+#include "NumberParser.hxx"
+#include "io/BufferedOutputStream.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/StaticVector.hxx"
+#include "util/StringSplit.hxx"
+#include "util/StringStrip.hxx"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <tuple> // for std::tie()
+
+using std::string_view_literals::operator""sv;
+
+void
+CephLatencyHistory::Item::Add(Sample sample) noexcept
+{
+	samples[next] = sample;
+	next = (next + 1) % samples.size();
+	if (n_samples < samples.size())
+		++n_samples;
+}
+
+bool
+CephLatencyHistory::Update(std::string_view mount, std::string_view item,
+			   uint_least64_t count, double sum,
+			   std::span<double, quantiles.size()> dest)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	char key_buffer[256];
+	const std::string_view key{
+		key_buffer,
+		fmt::format_to_n(key_buffer, sizeof(key_buffer), "{}/{}"sv,
+				 mount, item).out,
+	};
+
+	const std::scoped_lock lock{mutex};
+
+	auto [i, inserted] = items.try_emplace(std::string{key});
+	auto &h = i->second;
+
+	if (inserted || count < h.count) {
+		/* first scrape, or the counters have been reset
+		   (e.g. after a remount) */
+		h.n_samples = h.next = 0;
+	} else if (count > h.count) {
+		const uint_least64_t delta = count - h.count;
+		h.Add({std::max(sum - h.sum, 0.) / delta, delta});
+	}
+
+	h.last_update = now;
+	h.count = count;
+	h.sum = sum;
+
+	if (h.n_samples == 0)
+		return false;
+
+	/* weighted nearest-rank quantiles: each interval counts as
+	   many times as it had operations */
+
+	std::array<Sample, N_SAMPLES> sorted;
+	std::copy_n(h.samples.begin(), h.n_samples, sorted.begin());
+	const std::span<Sample> s{sorted.data(), h.n_samples};
+	std::sort(s.begin(), s.end(), [](const Sample &a, const Sample &b){
+		return a.mean < b.mean;
+	});
+
+	uint_least64_t total = 0;
+	for (const auto &j : s)
+		total += j.count;
+
+	for (std::size_t q = 0; q < quantiles.size(); ++q) {
+		const double rank = quantiles[q] * total;
+
+		uint_least64_t cumulative = 0;
+		double value = s.back().mean;
+		for (const auto &j : s) {
+			cumulative += j.count;
+			if (cumulative >= rank) {
+				value = j.mean;
+				break;
+			}
+		}
+
+		dest[q] = value;
+	}
+
+	return true;
+}
+
+void
+CephLatencyHistory::Expire() noexcept
+{
+	const auto expiry = std::chrono::steady_clock::now() - std::chrono::hours{1};
+
+	const std::scoped_lock lock{mutex};
+
+	std::erase_if(items, [expiry](const auto &i){
+		return i.second.last_update < expiry;
+	});
+}
+
+namespace {
+
+enum class LatencyColumn : uint_least8_t {
+	UNKNOWN,
+	TOTAL,
+	SUM,
+	AVG,
+	MIN,
+	MAX,
+	STDEV,
+};
+
+struct LatencyValues {
+	double sum = -1, avg = -1, min = -1, max = -1, stdev = -1;
+	uint_least64_t total = 0;
+	bool have_total = false;
+};
+
+} // anonymous namespace
+
+static constexpr LatencyColumn
+ParseLatencyColumn(std::string_view name) noexcept
+{
+	if (name == "total"sv)
+		return LatencyColumn::TOTAL;
+	else if (name == "sum_lat(us)"sv)
+		return LatencyColumn::SUM;
+	else if (name == "avg_lat(us)"sv)
+		return LatencyColumn::AVG;
+	else if (name == "min_lat(us)"sv)
+		return LatencyColumn::MIN;
+	else if (name == "max_lat(us)"sv)
+		return LatencyColumn::MAX;
+	else if (name == "stdev(us)"sv)
+		return LatencyColumn::STDEV;
+	else
+		return LatencyColumn::UNKNOWN;
+}
+
+static LatencyValues
+ParseLatencyRow(std::span<const LatencyColumn> columns, std::string_view values) noexcept
+{
+	LatencyValues v;
+
+	for (const auto column : columns) {
+		std::string_view value;
+		std::tie(value, values) = Split(StripLeft(values), ' ');
+		if (value.empty())
+			break;
+
+		switch (column) {
+		case LatencyColumn::UNKNOWN:
+			break;
+
+		case LatencyColumn::TOTAL:
+			v.total = ParseUint64(value);
+			v.have_total = true;
+			break;
+
+		case LatencyColumn::SUM:
+			v.sum = ParseDouble(value) * 1e-6;
+			break;
+
+		case LatencyColumn::AVG:
+			v.avg = ParseDouble(value) * 1e-6;
+			break;
+
+		case LatencyColumn::MIN:
+			v.min = ParseDouble(value) * 1e-6;
+			break;
+
+		case LatencyColumn::MAX:
+			v.max = ParseDouble(value) * 1e-6;
+			break;
+
+		case LatencyColumn::STDEV:
+			v.stdev = ParseDouble(value) * 1e-6;
+			break;
+		}
+	}
+
+	/* newer kernels have "avg_lat" instead of "sum_lat" */
+	if (v.sum < 0 && v.avg >= 0)
+		v.sum = v.avg * v.total;
+
+	return v;
+}
+
+void
+ExportCephLatency(BufferedOutputStream &os, std::string_view fsid, std::string_view name,
+		  std::string_view mount, std::string_view contents,
+		  CephLatencyHistory &history)
+{
+	const auto [header, rest] = Split(contents, '\n');
+
+	/* the column layout differs between kernel versions; map
+	   the header labels (after "item") to columns */
+	StaticVector<LatencyColumn, 8> columns;
+	for (const std::string_view i : IterableSplitString(Split(header, ' ').second, ' ')) {
+		if (i.empty())
+			continue;
+
+		if (columns.full())
+			break;
+
+		columns.push_back(ParseLatencyColumn(i));
+	}
+
+	// skip the separator line
+	contents = Split(rest, '\n').second;
+
+	for (const auto line : IterableSplitString(contents, '\n')) {
+		const auto [item, values] = Split(line, ' ');
+		if (item.empty())
+			continue;
+
+		const auto v = ParseLatencyRow(columns, values);
+		if (!v.have_total)
+			continue;
+
+		os.Fmt("ceph_metrics_latency_seconds_count{{fsid={:?},name={:?},item={:?}}} {}\n",
+		       fsid, name, item, v.total);
+
+		if (v.sum >= 0) {
+			os.Fmt("ceph_metrics_latency_seconds_sum{{fsid={:?},name={:?},item={:?}}} {:e}\n",
+			       fsid, name, item, v.sum);
+
+			std::array<double, CephLatencyHistory::quantiles.size()> q;
+			if (history.Update(mount, item, v.total, v.sum, q))
+				for (std::size_t i = 0; i < q.size(); ++i)
+					os.Fmt("ceph_metrics_latency_seconds{{fsid={:?},name={:?},item={:?},quantile=\"{}\"}} {:e}\n",
+					       fsid, name, item,
+					       CephLatencyHistory::quantiles[i], q[i]);
+		}
+
+		if (v.total == 0)
+			/* min/max/stdev are meaningless without
+			   operations */
+			continue;
+
+		if (v.min >= 0)
+			os.Fmt("ceph_metrics_latency_min_seconds{{fsid={:?},name={:?},item={:?}}} {:e}\n",
+			       fsid, name, item, v.min);
+
+		if (v.max >= 0)
+			os.Fmt("ceph_metrics_latency_max_seconds{{fsid={:?},name={:?},item={:?}}} {:e}\n",
+			       fsid, name, item, v.max);
+
+		if (v.stdev >= 0)
+			os.Fmt("ceph_metrics_latency_stdev_seconds{{fsid={:?},name={:?},item={:?}}} {:e}\n",
+			       fsid, name, item, v.stdev);
+	}
+}
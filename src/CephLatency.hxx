@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+
+class BufferedOutputStream;
+
+/**
+ * Remembers the latency counters of all Ceph mounts from previous
+ * scrapes.  The average latency between two scrapes is one sample
+ * (weighted with the number of operations in that interval) of a
+ * rolling latency distribution.
+ *
+ * This class is thread-safe because Ceph mounts may be collected by
+ * several worker threads.
+ */
+class CephLatencyHistory {
+	/**
+	 * The number of intervals in the rolling window.
+	 */
+	static constexpr std::size_t N_SAMPLES = 30;
+
+	struct Sample {
+		/**
+		 * The average latency in this interval [s].
+		 */
+		double mean;
+
+		/**
+		 * The number of operations in this interval.
+		 */
+		uint_least64_t count;
+	};
+
+	struct Item {
+		std::chrono::steady_clock::time_point last_update;
+
+		/**
+		 * The counters from the previous scrape.
+		 */
+		uint_least64_t count = 0;
+		double sum = 0;
+
+		/**
+		 * A ring buffer of the most recent samples.
+		 */
+		std::array<Sample, N_SAMPLES> samples;
+		std::size_t n_samples = 0, next = 0;
+
+		void Add(Sample sample) noexcept;
+	};
+
+	std::mutex mutex;
+
+	/**
+	 * Key is "<fsid>.<client>/<item>".
+	 */
+	std::map<std::string, Item, std::less<>> items;
+
+public:
+	static constexpr std::array quantiles{0.5, 0.9, 0.99};
+
+	/**
+	 * Submit the current counters of one item and calculate the
+	 * quantiles of the rolling distribution.  Throws on error
+	 * (out of memory).
+	 *
+	 * @param count the total number of operations
+	 * @param sum the total latency of all operations [s]
+	 * @param dest the quantile values will be written here
+	 * @return false if there are no samples yet
+	 */
+	bool Update(std::string_view mount, std::string_view item,
+		    uint_least64_t count, double sum,
+		    std::span<double, quantiles.size()> dest);
+
+	/**
+	 * Forget items which have not been updated for a while
+	 * (i.e. unmounted file systems).
+	 */
+	void Expire() noexcept;
+};
+
+/**
+ * Export /sys/kernel/debug/ceph/.../metrics/latency
+ *
+ * @param mount the directory name ("<fsid>.<client>")
+ */
+void
+ExportCephLatency(BufferedOutputStream &os, std::string_view fsid, std::string_view name,
+		  std::string_view mount, std::string_view contents,
+		  CephLatencyHistory &history);
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "CephOsdc.hxx"
+#include "io/BufferedOutputStream.hxx"
+#include "io/BufferedReader.hxx"
+#include "io/FdReader.hxx"
+#include "io/FileAt.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/CharUtil.hxx"
+#include "util/NumberParser.hxx"
+#include "util/StringCompare.hxx"
+#include "util/StringSplit.hxx"
+
+#include <fmt/format.h>
+
+#include <algorithm> // for std::min(), std::max()
+
+using std::string_view_literals::operator""sv;
+
+void
+CephOsdcHistory::Mount::Add(Scrape scrape) noexcept
+{
+	scrapes[next] = scrape;
+	next = (next + 1) % scrapes.size();
+	if (n_scrapes < scrapes.size())
+		++n_scrapes;
+}
+
+std::chrono::steady_clock::time_point
+CephOsdcHistory::Mount::FindSubmitTime(uint_least64_t tid) const noexcept
+{
+	/* walk from the oldest to the newest scrape */
+	std::size_t i = (next + scrapes.size() - n_scrapes) % scrapes.size();
+	for (std::size_t n = 0; n < n_scrapes; ++n) {
+		const auto &scrape = scrapes[i];
+		if (scrape.max_tid >= tid)
+			return scrape.time;
+
+		i = (i + 1) % scrapes.size();
+	}
+
+	return last_update;
+}
+
+const CephOsdcHistory::Mount &
+CephOsdcHistory::UpdateMount(std::string_view mount, uint_least64_t max_tid,
+			     std::chrono::steady_clock::time_point now)
+{
+	auto &m = mounts.try_emplace(std::string{mount}).first->second;
+	m.last_update = now;
+
+	/* only scrapes which saw a new tid are interesting; the
+	   highest pending tid may also decrease if the newest
+	   requests have completed */
+	if (m.n_scrapes == 0 ||
+	    max_tid > m.scrapes[(m.next + m.scrapes.size() - 1) % m.scrapes.size()].max_tid)
+		m.Add({now, max_tid});
+
+	return m;
+}
+
+void
+CephOsdcHistory::Expire() noexcept
+{
+	const auto expiry = std::chrono::steady_clock::now() - std::chrono::hours{1};
+
+	const std::scoped_lock lock{mutex};
+
+	std::erase_if(mounts, [expiry](const auto &i){
+		return i.second.last_update < expiry;
+	});
+}
+
+namespace {
+
+struct CephOsdTarget {
+	uint_least64_t count = 0;
+
+	uint_least64_t min_tid = UINT_LEAST64_MAX;
+
+	double oldest_age = 0;
+};
+
+struct CephOsdc {
+	/**
+	 * Key is the OSD number (-1 for "homeless" requests) and the
+	 * pool id.  This is bounded by the size of the cluster, not
+	 * by the number of pending requests.
+	 */
+	std::map<std::pair<int, uint_least64_t>, CephOsdTarget> targets;
+
+	uint_least64_t max_tid = 0;
+};
+
+} // anonymous namespace
+
+/**
+ * Parse one request line:
+ * "TID\tosdN\tPOOL.SEED\t[ACTING]/P\t[UP]/P\t..."
+ */
+static void
+LoadOsdcRequest(std::string_view line, CephOsdc &result) noexcept
+{
+	const auto [tid_s, rest1] = Split(line, '\t');
+	const auto [osd_s, rest2] = Split(rest1, '\t');
+	const auto [pgid, rest3] = Split(rest2, '\t');
+
+	uint_least64_t tid;
+	int osd;
+	uint_least64_t pool;
+	if (!ParseIntegerTo(tid_s, tid) ||
+	    !ParseIntegerTo(StringAfterPrefix(osd_s, "osd"sv), osd) ||
+	    !ParseIntegerTo(Split(pgid, '.').first, pool))
+		return;
+
+	auto &target = result.targets[{osd, pool}];
+	++target.count;
+	target.min_tid = std::min(target.min_tid, tid);
+
+	result.max_tid = std::max(result.max_tid, tid);
+}
+
+static void
+LoadOsdc(BufferedReader &r, CephOsdc &result)
+{
+	/* old kernels have no section headers */
+	bool requests = true;
+
+	char *line;
+	while ((line = r.ReadLine()) != nullptr) {
+		const std::string_view s{line};
+		if (s.empty())
+			continue;
+
+		if (!IsDigitASCII(s.front())) {
+			/* a section header: "REQUESTS", "LINGER
+			   REQUESTS" or "BACKOFFS"; only the first one
+			   has the format we're interested in */
+			requests = s.starts_with("REQUESTS"sv);
+			continue;
+		}
+
+		if (requests)
+			LoadOsdcRequest(s, result);
+	}
+}
+
+static bool
+LoadOsdc(FileAt file, CephOsdc &result)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(file))
+		return false;
+
+	FdReader reader{fd};
+	BufferedReader buffered_reader{reader};
+
+	LoadOsdc(buffered_reader, result);
+	return true;
+}
+
+void
+ExportCephOsdc(BufferedOutputStream &os, std::string_view fsid, std::string_view name,
+	       std::string_view mount, FileDescriptor subdir,
+	       CephOsdcHistory &history)
+{
+	CephOsdc osdc;
+	if (!LoadOsdc({subdir, "osdc"}, osdc))
+		return;
+
+	history.Update(mount, osdc.max_tid, [&osdc](auto estimate_age){
+		for (auto &[key, target] : osdc.targets)
+			target.oldest_age = estimate_age(target.min_tid);
+	});
+
+	for (const auto &[key, target] : osdc.targets) {
+		const auto [osd, pool] = key;
+
+		char osd_buffer[16];
+		const std::string_view osd_label = osd >= 0
+			? std::string_view{osd_buffer, fmt::format_to(osd_buffer, "{}"sv, osd)}
+			: "homeless"sv;
+
+		os.Fmt("ceph_osd_pending_requests{{fsid={:?},name={:?},osd={:?},pool=\"{}\"}} {}\n"
+		       "ceph_osd_oldest_request_age_seconds{{fsid={:?},name={:?},osd={:?},pool=\"{}\"}} {:e}\n",
+		       fsid, name, osd_label, pool, target.count,
+		       fsid, name, osd_label, pool, target.oldest_age);
+	}
+}
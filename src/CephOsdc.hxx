@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+class BufferedOutputStream;
+class FileDescriptor;
+
+/**
+ * The "osdc" file does not show how long a request has been
+ * pending, but request ids ("tid") are allocated in ascending order.
+ * This class remembers the highest tid seen by recent scrapes of
+ * each mount; a pending request must have been submitted before the
+ * first scrape which saw a tid at least as high.  This yields a
+ * lower bound for the age of the oldest request.
+ *
+ * This class is thread-safe because Ceph mounts may be collected by
+ * several worker threads.
+ */
+class CephOsdcHistory {
+	/**
+	 * The number of scrapes to remember.  Ages longer than that
+	 * many scrape intervals are underestimated.
+	 */
+	static constexpr std::size_t N_SCRAPES = 64;
+
+	struct Scrape {
+		std::chrono::steady_clock::time_point time;
+		uint_least64_t max_tid;
+	};
+
+	struct Mount {
+		std::chrono::steady_clock::time_point last_update;
+
+		/**
+		 * A ring buffer of the most recent scrapes which saw
+		 * a new tid.
+		 */
+		std::array<Scrape, N_SCRAPES> scrapes;
+		std::size_t n_scrapes = 0, next = 0;
+
+		void Add(Scrape scrape) noexcept;
+
+		[[gnu::pure]]
+		std::chrono::steady_clock::time_point FindSubmitTime(uint_least64_t tid) const noexcept;
+	};
+
+	std::mutex mutex;
+
+	/**
+	 * Key is the directory name ("<fsid>.<client>").
+	 */
+	std::map<std::string, Mount, std::less<>> mounts;
+
+public:
+	/**
+	 * Submit the highest tid currently pending on this mount.
+	 *
+	 * @param f a function which is invoked (with the mutex
+	 * locked) with another function which estimates the age [s]
+	 * of a pending request from its tid
+	 */
+	void Update(std::string_view mount, uint_least64_t max_tid,
+		    auto f) {
+		const auto now = std::chrono::steady_clock::now();
+
+		const std::scoped_lock lock{mutex};
+		const Mount &m = UpdateMount(mount, max_tid, now);
+
+		f([&m, now](uint_least64_t tid){
+			return std::chrono::duration<double>{now - m.FindSubmitTime(tid)}.count();
+		});
+	}
+
+	/**
+	 * Forget mounts which have not been updated for a while
+	 * (i.e. unmounted file systems).
+	 */
+	void Expire() noexcept;
+
+private:
+	const Mount &UpdateMount(std::string_view mount, uint_least64_t max_tid,
+				 std::chrono::steady_clock::time_point now);
+};
+
+/**
+ * Export /sys/kernel/debug/ceph/.../osdc: the number of pending
+ * requests and the (estimated) age of the oldest one per OSD and
+ * pool.  The file is streamed, therefore memory usage does not
+ * depend on the number of pending requests.
+ *
+ * @param subdir the "/sys/kernel/debug/ceph/<fsid>.<client>"
+ * directory
+ * @param mount the directory name ("<fsid>.<client>")
+ */
+void
+ExportCephOsdc(BufferedOutputStream &os, std::string_view fsid, std::string_view name,
+	       std::string_view mount, FileDescriptor subdir,
+	       CephOsdcHistory &history);
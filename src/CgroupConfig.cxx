@@ -5,6 +5,8 @@
 #include "CgroupConfig.hxx"
 #include "Yaml.hxx"
 
+#include <stdexcept>
+
 #include <fnmatch.h>
 
 bool
@@ -17,20 +19,60 @@ CgroupExporterConfig::CheckIgnoreName(const char *name) const noexcept
 	return false;
 }
 
+bool
+CgroupExporterConfig::CheckIgnoreFile(const char *name) const noexcept
+{
+	for (const auto &i : ignore_files)
+		if (fnmatch(i.c_str(), name, 0) == 0)
+			return true;
+
+	return false;
+}
+
+static void
+LoadStringSet(std::set<std::string, std::less<>> &dest, const YAML::Node &node)
+{
+	if (node && node.IsSequence())
+		for (const auto &i : node)
+			dest.emplace(i.as<std::string>());
+}
+
+static void
+LoadKeyFilter(CgroupKeyFilter &filter, const YAML::Node &node)
+{
+	if (!node)
+		return;
+
+	if (!node.IsMap())
+		throw std::runtime_error("Key filter must be a map");
+
+	LoadStringSet(filter.keys, node["keys"]);
+	LoadStringSet(filter.ignore_keys, node["ignore_keys"]);
+}
+
 static auto
 LoadCgroupExporterConfig(const YAML::Node &node)
 {
 	CgroupExporterConfig config;
 
-	const auto ops = node["opaque_paths"];
-	if (ops && ops.IsSequence())
-		for (const auto &i : ops)
-			config.opaque_paths.emplace(i.as<std::string>());
+	LoadStringSet(config.opaque_paths, node["opaque_paths"]);
+	LoadStringSet(config.ignore_names, node["ignore_names"]);
+	LoadStringSet(config.ignore_files, node["ignore_files"]);
+
+	LoadKeyFilter(config.memory_stat, node["memory_stat"]);
+	LoadKeyFilter(config.memory_events, node["memory_events"]);
+
+	if (const auto i = node["max_series_per_family"])
+		config.max_series_per_family = i.as<std::size_t>();
+
+	if (const auto i = node["threads"]) {
+		config.threads = i.as<unsigned>();
+		if (config.threads < 1)
+			throw std::runtime_error("'threads' must be at least 1");
+	}
 
-	const auto ins = node["ignore_names"];
-	if (ins && ins.IsSequence())
-		for (const auto &i : ins)
-			config.ignore_names.emplace(i.as<std::string>());
+	if (const auto i = node["persistent_tree"])
+		config.persistent_tree = i.as<bool>();
 
 	return config;
 }
@@ -4,16 +4,68 @@
 
 #pragma once
 
+#include <cstddef>
 #include <set>
 #include <string>
+#include <string_view>
+
+/**
+ * Selects the keys of a file like "memory.stat" which shall be
+ * exported.
+ */
+struct CgroupKeyFilter {
+	/**
+	 * If not empty, then only these keys are exported.
+	 */
+	std::set<std::string, std::less<>> keys;
+
+	std::set<std::string, std::less<>> ignore_keys;
+
+	[[gnu::pure]]
+	bool Check(std::string_view key) const noexcept {
+		return (keys.empty() || keys.contains(key)) &&
+			!ignore_keys.contains(key);
+	}
+};
 
 struct CgroupExporterConfig {
 	std::set<std::string, std::less<>> opaque_paths;
 
 	std::set<std::string, std::less<>> ignore_names;
 
+	/**
+	 * Patterns of control files which shall not be read.
+	 */
+	std::set<std::string, std::less<>> ignore_files;
+
+	CgroupKeyFilter memory_stat, memory_events;
+
+	/**
+	 * The maximum number of series per metric family; the rest
+	 * is dropped (and counted).  0 means unlimited.
+	 */
+	std::size_t max_series_per_family = 0;
+
+	/**
+	 * The number of threads walking the cgroup2 tree.  1 means
+	 * walk in the main thread only.  If threads cannot be
+	 * created (e.g. because of "TasksMax"), the exporter
+	 * continues with fewer.
+	 */
+	unsigned threads = 1;
+
+	/**
+	 * Keep a persistent copy of the cgroup2 tree which is
+	 * updated via inotify instead of walking the whole tree on
+	 * each scrape?
+	 */
+	bool persistent_tree = false;
+
 	[[gnu::pure]]
 	bool CheckIgnoreName(const char *name) const noexcept;
+
+	[[gnu::pure]]
+	bool CheckIgnoreFile(const char *name) const noexcept;
 };
 
 CgroupExporterConfig
@@ -4,23 +4,34 @@
 
 #include "Frontend.hxx"
 #include "CgroupConfig.hxx"
+#include "CgroupOutput.hxx"
+#include "CgroupTree.hxx"
+#include "BlockDevices.hxx"
 #include "Pressure.hxx"
 #include "NumberParser.hxx"
+#include "DirentReader.hxx"
 #include "io/BufferedOutputStream.hxx"
-#include "io/DirectoryReader.hxx"
 #include "io/FileAt.hxx"
 #include "io/Open.hxx"
 #include "io/SmallTextFile.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/IterableSplitString.hxx"
 #include "util/PrintException.hxx"
+#include "util/NumberParser.hxx"
 #include "util/StringCompare.hxx"
 
 #include <algorithm>
+#include <atomic>
 #include <concepts>
+#include <condition_variable>
+#include <cerrno>
 #include <cstdlib>
-#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <fcntl.h>
 #include <string.h>
@@ -50,13 +61,13 @@ ReadUint64File(auto &&file)
 
 [[gnu::pure]]
 static double
-ReadDoubleFile(FileAt file, double factor=1.0)
+ReadDoubleFile(auto &&file, double factor=1.0)
 {
 	return WithSmallTextFile<64>(file, ParseUint64) * factor;
 }
 
 static void
-ForEachNameValue(FileAt file,
+ForEachNameValue(auto &&file,
 		 std::invocable<std::string_view, std::string_view> auto f)
 {
 	ForEachTextLine<4096>(file, [&f](std::string_view line){
@@ -67,71 +78,400 @@ ForEachNameValue(FileAt file,
 	});
 }
 
-struct CgroupCpuacctValues {
-	double usage = -1, user = -1, system = -1;
-};
+static void
+WriteCpuacct(CgroupOutput &output, std::string_view group, std::string_view type,
+	     double value)
+{
+	if (value >= 0)
+		output.Fmt(CgroupFamily::CPU_USAGE,
+			   "cgroup_cpu_usage{{groupname={:?},type={:?}}} {:e}\n",
+			   group, type, value);
+}
 
-struct CgroupMemoryValues {
-	int64_t usage = -1, kmem_usage = -1, memsw_usage = -1;
-	int64_t swap_usage = -1;
-	std::map<std::string, uint64_t, std::less<>> stat, events;
-};
+static void
+WriteMemory(CgroupOutput &output, std::string_view group, std::string_view type,
+	    int64_t value)
+{
+	if (value >= 0)
+		output.Fmt(CgroupFamily::MEMORY_USAGE,
+			   "cgroup_memory_usage{{groupname={:?},type={:?}}} {}\n",
+			   group, type, value);
+}
 
-struct CgroupPidsValues {
-	int64_t current = -1;
-	int64_t forks = -1;
-	std::map<std::string, uint64_t, std::less<>> events;
-};
+static void
+WriteMemory(CgroupOutput &output, std::string_view group, std::string_view type,
+	    uint64_t value)
+{
+	output.Fmt(CgroupFamily::MEMORY_USAGE,
+		   "cgroup_memory_usage{{groupname={:?},type={:?}}} {}\n",
+		   group, type, value);
+}
+
+static void
+WriteSimple(CgroupOutput &output, CgroupFamily family, std::string_view metric,
+	    std::string_view group, int64_t value)
+{
+	if (value >= 0)
+		output.Fmt(family, "{}{{groupname={:?}}} {}\n",
+			   metric, group, value);
+}
+
+/**
+ * Copy a file with "name value" lines (e.g. "memory.events") to
+ * the output.
+ */
+static void
+WriteEvents(CgroupOutput &output, CgroupFamily family, std::string_view metric,
+	    std::string_view group, FileDescriptor fd,
+	    std::predicate<std::string_view> auto filter)
+{
+	ForEachNameValue(fd, [&](auto name, auto value){
+		if (filter(name))
+			output.Fmt(family, "{}{{groupname={:?},type={:?}}} {}\n",
+				   metric, group, name, ParseUint64(value));
+	});
+}
+
+static void
+WriteEvents(CgroupOutput &output, CgroupFamily family, std::string_view metric,
+	    std::string_view group, FileDescriptor fd,
+	    const CgroupKeyFilter &filter)
+{
+	WriteEvents(output, family, metric, group, fd, [&filter](std::string_view name){
+		return filter.Check(name);
+	});
+}
 
-struct CgroupValues {
-	CgroupCpuacctValues cpuacct;
-	CgroupMemoryValues memory;
-	CgroupPidsValues pids;
-	PressureValues cpu_pressure, io_pressure, memory_pressure;
+static void
+WriteEvents(CgroupOutput &output, CgroupFamily family, std::string_view metric,
+	    std::string_view group, FileDescriptor fd)
+{
+	WriteEvents(output, family, metric, group, fd, [](std::string_view){
+		return true;
+	});
+}
+
+/**
+ * Write a cgroup2 limit file ("memory.max" etc.); "max" means there
+ * is no limit and is omitted.
+ */
+static void
+WriteMemoryLimit(CgroupOutput &output, std::string_view group,
+		 std::string_view type, FileDescriptor fd)
+{
+	WithSmallTextFile<64>(fd, [&](std::string_view contents){
+		contents = Strip(contents);
+		if (contents.empty() || !IsDigitASCII(contents.front()))
+			return;
+
+		output.Fmt(CgroupFamily::MEMORY_LIMIT,
+			   "cgroup_memory_limit{{groupname={:?},type={:?}}} {}\n",
+			   group, type, ParseUint64(contents));
+	});
+}
+
+/**
+ * Parse one "io.stat" line
+ * ("MAJ:MIN rbytes=N wbytes=N rios=N wios=N dbytes=N dios=N")
+ * without copying it.
+ */
+static void
+WriteIoStatLine(CgroupOutput &output, BlockDeviceNames &devices,
+		std::string_view group, std::string_view line)
+{
+	const auto [device, rest] = Split(Strip(line), ' ');
+	const auto [major_s, minor_s] = Split(device, ':');
+
+	unsigned major, minor;
+	if (!ParseIntegerTo(major_s, major) || !ParseIntegerTo(minor_s, minor))
+		return;
+
+	const std::string_view device_name = devices.Get(major, minor);
+
+	for (const std::string_view i : IterableSplitString(rest, ' ')) {
+		const auto [key, value] = Split(i, '=');
+		if (key.empty())
+			continue;
+
+		std::string_view type;
+		switch (key.front()) {
+		case 'r':
+			type = "read"sv;
+			break;
+
+		case 'w':
+			type = "write"sv;
+			break;
+
+		case 'd':
+			type = "discard"sv;
+			break;
+
+		default:
+			continue;
+		}
+
+		const auto suffix = key.substr(1);
+		if (suffix == "bytes"sv)
+			output.Fmt(CgroupFamily::IO_BYTES,
+				   "cgroup_io_bytes{{groupname={:?},device={:?},type={:?}}} {}\n",
+				   group, device_name, type, ParseUint64(value));
+		else if (suffix == "ios"sv)
+			output.Fmt(CgroupFamily::IO_OPERATIONS,
+				   "cgroup_io_operations{{groupname={:?},device={:?},type={:?}}} {}\n",
+				   group, device_name, type, ParseUint64(value));
+	}
+}
+
+static void
+WriteIoStat(CgroupOutput &output, BlockDeviceNames &devices,
+	    std::string_view group, FileDescriptor fd)
+{
+	ForEachTextLine<16384>(fd, [&](std::string_view line){
+		WriteIoStatLine(output, devices, group, line);
+	});
+}
+
+static void
+WritePressureRatio(CgroupOutput &output, std::string_view group,
+		   std::string_view resource, std::string_view type,
+		   std::string_view window, double value)
+{
+	if (value >= 0)
+		output.Fmt(CgroupFamily::PRESSURE_RATIO,
+			   "cgroup_pressure_ratio{{groupname={:?},resource={:?},type={:?},window={:?}}} {:e}\n",
+			   group, resource, type, window, value);
+}
+
+static void
+WritePressureRatio(CgroupOutput &output, std::string_view group,
+		   std::string_view resource, std::string_view type,
+		   const PressureItemValues &values)
+{
+	WritePressureRatio(output, group, resource, type, "10"sv, values.avg10);
+	WritePressureRatio(output, group, resource, type, "60"sv, values.avg60);
+	WritePressureRatio(output, group, resource, type, "300"sv, values.avg300);
+}
+
+static void
+WritePressureStallTime(CgroupOutput &output, std::string_view group,
+		       std::string_view resource, std::string_view type,
+		       double value)
+{
+	if (value >= 0)
+		output.Fmt(CgroupFamily::PRESSURE_STALL_TIME,
+			   "cgroup_pressure_stall_time{{groupname={:?},resource={:?},type={:?}}} {:e}\n",
+			   group, resource, type, value);
+}
+
+static void
+WritePressure(CgroupOutput &output, std::string_view group,
+	      std::string_view resource, FileDescriptor fd)
+{
+	const auto values = ReadPressureFile(fd);
+	WritePressureRatio(output, group, resource, "some"sv, values.some);
+	WritePressureRatio(output, group, resource, "full"sv, values.full);
+	WritePressureStallTime(output, group, resource, "some"sv, values.some.stall_time);
+	WritePressureStallTime(output, group, resource, "full"sv, values.full.stall_time);
+}
+
+/**
+ * The cgroup1 hierarchy a control file belongs to.
+ */
+enum class Cgroup1Hierarchy : uint_least8_t {
+	NONE,
+	CPUACCT,
+	MEMORY,
+	PIDS,
+	UNIFIED,
 };
 
-struct CgroupsData {
-	std::map<std::string, CgroupValues, std::less<>> groups;
+struct WalkContext;
+
+/**
+ * A control file which is read from each cgroup.
+ */
+struct CgroupFile {
+	const char *name;
+
+	/**
+	 * The cgroup1 hierarchy which has this file or
+	 * Cgroup1Hierarchy::NONE if this is cgroup2 only.
+	 */
+	Cgroup1Hierarchy cgroup1;
+
+	/**
+	 * Does cgroup2 have this file?
+	 */
+	bool cgroup2;
+
+	/**
+	 * Read the file and write its samples to the output.
+	 */
+	void (*handler)(WalkContext &ctx, std::string_view group,
+			FileDescriptor fd);
 };
 
+class ParallelCgroupWalk;
+
 struct WalkContext {
 	const CgroupExporterConfig &config;
-	CgroupsData &data;
+	BlockDeviceNames &devices;
+	CgroupOutput &output;
+
+	/**
+	 * The control files to be read from each cgroup: the subset
+	 * of #cgroup_files which exists in this hierarchy and is not
+	 * ignored by the configuration.
+	 */
+	std::vector<const CgroupFile *> files;
 
 	char path[4096];
 	size_t length = 0;
 
+	/**
+	 * @param cgroup1 the cgroup1 hierarchy to be walked or
+	 * Cgroup1Hierarchy::NONE for cgroup2
+	 */
 	WalkContext(const CgroupExporterConfig &_config,
-		    CgroupsData &_data) noexcept
-		:config(_config), data(_data)
-	{
-		path[0] = 0;
+		    BlockDeviceNames &_devices,
+		    CgroupOutput &_output,
+		    Cgroup1Hierarchy cgroup1) noexcept;
+
+	/**
+	 * If set, then subdirectories are submitted to this object
+	 * instead of being walked recursively.
+	 */
+	ParallelCgroupWalk *parallel = nullptr;
+	std::size_t worker_index;
+
+	void SetPath(std::string_view _path) noexcept {
+		length = std::min(_path.size(), sizeof(path) - 1);
+		std::copy_n(_path.data(), length, path);
+		path[length] = 0;
 	}
 
 	void Dive(FileAt file);
-	void HandleRegularFile(FileAt file);
+	void Submit(const char *name);
+	void HandleGroup(FileDescriptor directory_fd);
 	void DoWalk(UniqueFileDescriptor directory_fd);
 };
 
-enum class WalkDecision { IGNORE, DIRECTORY, REGULAR };
+static constexpr double nano_factor = 1e-9;
 
-static WalkDecision
-CheckWalkFile(FileAt file)
-{
-	if (*file.name == '.')
-		return WalkDecision::IGNORE;
+static constexpr CgroupFile cgroup_files[] = {
+	{"cpuacct.usage", Cgroup1Hierarchy::CPUACCT, false, [](auto &ctx, auto group, auto fd){
+		WriteCpuacct(ctx.output, group, "total"sv, ReadDoubleFile(fd, nano_factor));
+	}},
+	{"cpuacct.stat", Cgroup1Hierarchy::CPUACCT, false, [](auto &ctx, auto group, auto fd){
+		ForEachNameValue(fd, [&](auto name, auto value){
+			if (name == "user"sv || name == "system"sv)
+				WriteCpuacct(ctx.output, group, name, ParseUserHz(value));
+		});
+	}},
+	{"cpu.stat", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		ForEachNameValue(fd, [&](auto name, auto value){
+			if (name == "usage_usec"sv)
+				WriteCpuacct(ctx.output, group, "total"sv, ParseUsec(value));
+			else if (name == "user_usec"sv)
+				WriteCpuacct(ctx.output, group, "user"sv, ParseUsec(value));
+			else if (name == "system_usec"sv)
+				WriteCpuacct(ctx.output, group, "system"sv, ParseUsec(value));
+			else if (name == "nr_throttled"sv)
+				WriteSimple(ctx.output, CgroupFamily::CPU_THROTTLED_PERIODS,
+					    "cgroup_cpu_throttled_periods"sv,
+					    group, ParseUint64(value));
+			else if (name == "throttled_usec"sv)
+				ctx.output.Fmt(CgroupFamily::CPU_THROTTLED_TIME,
+					       "cgroup_cpu_throttled_time{{groupname={:?}}} {:e}\n",
+					       group, ParseUsec(value));
+		});
+	}},
+	{"memory.usage_in_bytes", Cgroup1Hierarchy::MEMORY, false, [](auto &ctx, auto group, auto fd){
+		WriteMemory(ctx.output, group, "total"sv, ReadUint64File(fd));
+	}},
+	{"memory.current", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		WriteMemory(ctx.output, group, "total"sv, ReadUint64File(fd));
+	}},
+	{"memory.swap.current", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		WriteMemory(ctx.output, group, "swap"sv, ReadUint64File(fd));
+	}},
+	{"memory.kmem.usage_in_bytes", Cgroup1Hierarchy::MEMORY, false, [](auto &ctx, auto group, auto fd){
+		WriteMemory(ctx.output, group, "kmem.total"sv, ReadUint64File(fd));
+	}},
+	{"memory.memsw.usage_in_bytes", Cgroup1Hierarchy::MEMORY, false, [](auto &ctx, auto group, auto fd){
+		WriteMemory(ctx.output, group, "memsw.total"sv, ReadUint64File(fd));
+	}},
+	{"memory.max", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		WriteMemoryLimit(ctx.output, group, "max"sv, fd);
+	}},
+	{"memory.high", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		WriteMemoryLimit(ctx.output, group, "high"sv, fd);
+	}},
+	{"memory.swap.max", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		WriteMemoryLimit(ctx.output, group, "swap.max"sv, fd);
+	}},
+	{"memory.stat", Cgroup1Hierarchy::MEMORY, true, [](auto &ctx, auto group, auto fd){
+		ForEachNameValue(fd, [&](auto name, auto value){
+			/* skip hierarchical_memory_limit */
+			if (!name.ends_with("_limit"sv) &&
+			    ctx.config.memory_stat.Check(name))
+				WriteMemory(ctx.output, group, name, ParseUint64(value));
+		});
+	}},
+	{"memory.events", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		WriteEvents(ctx.output, CgroupFamily::MEMORY_EVENTS, "cgroup_memory_events"sv,
+			    group, fd, ctx.config.memory_events);
+	}},
+	{"pids.current", Cgroup1Hierarchy::PIDS, true, [](auto &ctx, auto group, auto fd){
+		WriteSimple(ctx.output, CgroupFamily::PIDS, "cgroup_pids"sv,
+			    group, ReadUint64File(fd));
+	}},
+	{"pids.forks", Cgroup1Hierarchy::PIDS, true, [](auto &ctx, auto group, auto fd){
+		WriteSimple(ctx.output, CgroupFamily::FORKS, "cgroup_forks"sv,
+			    group, ReadUint64File(fd));
+	}},
+	{"pids.events", Cgroup1Hierarchy::PIDS, true, [](auto &ctx, auto group, auto fd){
+		WriteEvents(ctx.output, CgroupFamily::PIDS_EVENTS, "cgroup_pids_events"sv,
+			    group, fd);
+	}},
+	{"io.stat", Cgroup1Hierarchy::NONE, true, [](auto &ctx, auto group, auto fd){
+		WriteIoStat(ctx.output, ctx.devices, group, fd);
+	}},
+	{"cpu.pressure", Cgroup1Hierarchy::UNIFIED, true, [](auto &ctx, auto group, auto fd){
+		WritePressure(ctx.output, group, "cpu"sv, fd);
+	}},
+	{"io.pressure", Cgroup1Hierarchy::UNIFIED, true, [](auto &ctx, auto group, auto fd){
+		WritePressure(ctx.output, group, "io"sv, fd);
+	}},
+	{"memory.pressure", Cgroup1Hierarchy::UNIFIED, true, [](auto &ctx, auto group, auto fd){
+		WritePressure(ctx.output, group, "memory"sv, fd);
+	}},
+};
 
-	struct stat st;
-	if (fstatat(file.directory.Get(), file.name, &st,
-		    AT_NO_AUTOMOUNT|AT_SYMLINK_NOFOLLOW) < 0)
-		return WalkDecision::IGNORE;
+WalkContext::WalkContext(const CgroupExporterConfig &_config,
+			 BlockDeviceNames &_devices,
+			 CgroupOutput &_output,
+			 Cgroup1Hierarchy cgroup1) noexcept
+	:config(_config), devices(_devices), output(_output)
+{
+	path[0] = 0;
+
+	for (const auto &i : cgroup_files)
+		if ((cgroup1 == Cgroup1Hierarchy::NONE
+		     ? i.cgroup2
+		     : i.cgroup1 == cgroup1) &&
+		    !config.CheckIgnoreFile(i.name))
+			files.push_back(&i);
+}
 
-	if (S_ISREG(st.st_mode))
-		return WalkDecision::REGULAR;
-	else if (S_ISDIR(st.st_mode))
-		return WalkDecision::DIRECTORY;
-	else
-		return WalkDecision::IGNORE;
+/**
+ * Is this directory entry a cgroup (i.e. a directory)?
+ */
+static bool
+IsCgroupDirectory(FileAt file, unsigned char type) noexcept
+{
+	return *file.name != '.' && IsDirectory(file, type);
 }
 
 inline void
@@ -172,340 +512,393 @@ Substitute(char *dest, const char *src, const char *a, const char *b) noexcept
 }
 
 inline void
-WalkContext::HandleRegularFile(FileAt file)
+WalkContext::HandleGroup(FileDescriptor directory_fd)
 {
-	const char *base = file.name;
-	const char *group_name = path;
-
+	const char *group_name = nullptr;
 	char unescape_buffer[sizeof(path)];
-	if (strstr(group_name, "\\x2d") != nullptr) {
-		/* unescape the dash; it was escaped by systemd, but
-		   backslashes in file names are terrible to use */
-		Substitute(unescape_buffer, group_name, "\\x2d", "-");
-		group_name = unescape_buffer;
-	}
 
-	auto &group = data.groups[group_name];
+	for (const auto *i : files) {
+		UniqueFileDescriptor fd;
+		if (!fd.OpenReadOnly({directory_fd, i->name}))
+			/* ENOENT means the controller is not
+			   enabled; other errors (e.g. EACCES) would
+			   repeat for each cgroup on each scrape, so
+			   they are ignored as well */
+			continue;
+
+		if (group_name == nullptr) {
+			group_name = path;
+
+			if (strstr(group_name, "\\x2d") != nullptr) {
+				/* unescape the dash; it was escaped by
+				   systemd, but backslashes in file names
+				   are terrible to use */
+				Substitute(unescape_buffer, group_name, "\\x2d", "-");
+				group_name = unescape_buffer;
+			}
 
-	static constexpr double nano_factor = 1e-9;
+			output.BeginGroup(group_name);
+		}
 
-	if (StringIsEqual(base, "cpuacct.usage")) {
-		// cgroup1
-		group.cpuacct.usage = ReadDoubleFile(file, nano_factor);
-	} else if (StringIsEqual(base, "cpuacct.stat")) {
-		// cgroup1
-		ForEachNameValue(file, [&group](auto name, auto value){
-			if (name == "user"sv)
-				group.cpuacct.user = ParseUserHz(value);
-			else if (name == "system"sv)
-				group.cpuacct.system = ParseUserHz(value);
-		});
-	} else if (StringIsEqual(base, "cpu.stat")) {
-		// cgroup2
-		ForEachNameValue(file, [&group](auto name, auto value){
-			if (name == "usage_usec"sv)
-				group.cpuacct.usage = ParseUsec(value);
-			else if (name == "user_usec"sv)
-				group.cpuacct.user = ParseUsec(value);
-			else if (name == "system_usec"sv)
-				group.cpuacct.system = ParseUsec(value);
-		});
-	} else if (/* cgroup1 */
-		   StringIsEqual(base, "memory.usage_in_bytes") ||
-		   /* cgroup2 */
-		   StringIsEqual(base, "memory.current")) {
-		group.memory.usage = ReadUint64File(file);
-	} else if (StringIsEqual(base, "memory.swap.current")) {
-		// cgroup2
-		group.memory.swap_usage = ReadUint64File(file);
-	} else if (StringIsEqual(base, "memory.kmem.usage_in_bytes")) {
-		// cgroup1
-		group.memory.kmem_usage = ReadUint64File(file);
-	} else if (StringIsEqual(base, "memory.memsw.usage_in_bytes")) {
-		// cgroup1
-		group.memory.memsw_usage = ReadUint64File(file);
-	} else if (StringIsEqual(base, "memory.stat")) {
-		ForEachNameValue(file, [&group](auto name, auto value){
-			if (name.ends_with("_limit"sv))
-				/* skip hierarchical_memory_limit */
-				return;
-
-			group.memory.stat[std::string{name}] = ParseUint64(value);
-		});
-	} else if (StringIsEqual(base, "memory.events")) {
-		ForEachNameValue(file, [&group](auto name, auto value){
-			group.memory.events[std::string{name}] = ParseUint64(value);
-		});
-	} else if (StringIsEqual(base, "pids.current")) {
-		group.pids.current = ReadUint64File(file);
-	} else if (StringIsEqual(base, "pids.forks")) {
-		group.pids.forks = ReadUint64File(file);
-	} else if (StringIsEqual(base, "pids.events")) {
-		ForEachNameValue(file, [&group](auto name, auto value){
-			group.pids.events[std::string{name}] = ParseUint64(value);
-		});
-	} else if (StringIsEqual(base, "cpu.pressure")) {
-		group.cpu_pressure = ReadPressureFile(file);
-	} else if (StringIsEqual(base, "io.pressure")) {
-		group.io_pressure = ReadPressureFile(file);
-	} else if (StringIsEqual(base, "memory.pressure")) {
-		group.memory_pressure = ReadPressureFile(file);
+		try {
+			i->handler(*this, group_name, fd);
+		} catch (...) {
+			PrintException(std::current_exception());
+		}
 	}
 }
 
 void
 WalkContext::DoWalk(UniqueFileDescriptor directory_fd)
 {
-	DirectoryReader r(std::move(directory_fd));
+	/* open the interesting control files by name instead of
+	   looking at all of them */
+	HandleGroup(directory_fd);
 
-	const bool opaque = config.opaque_paths.find(path) != config.opaque_paths.end();
+	if (config.opaque_paths.find(path) != config.opaque_paths.end())
+		return;
 
-	while (auto name = r.Read()) {
-		const FileAt file{r.GetFileDescriptor(), name};
+	DirentReader r(std::move(directory_fd));
 
-		switch (CheckWalkFile(file)) {
-		case WalkDecision::IGNORE:
+	while (true) {
+		const auto [name, type] = r.Read();
+		if (name == nullptr)
 			break;
 
-		case WalkDecision::DIRECTORY:
-			if (!opaque && !config.CheckIgnoreName(name))
-				Dive(file);
-			break;
+		const FileAt file{r.GetFileDescriptor(), name};
+		if (!IsCgroupDirectory(file, type) || config.CheckIgnoreName(name))
+			continue;
 
-		case WalkDecision::REGULAR:
-			try {
-				HandleRegularFile(file);
-			} catch (...) {
-				PrintException(std::current_exception());
-			}
-			break;
-		}
+		if (parallel != nullptr)
+			Submit(name);
+		else
+			Dive(file);
 	}
 }
 
-static auto
-CollectCgroup1(const CgroupExporterConfig &config)
-{
-	CgroupsData data;
-
-	for (const char *mnt : {"/sys/fs/cgroup/cpuacct", "/sys/fs/cgroup/memory", "/sys/fs/cgroup/pids", "/sys/fs/cgroup/unified"}) {
-		WalkContext ctx(config, data);
-
-		try {
-			ctx.DoWalk(OpenDirectory({FileDescriptor::Undefined(), mnt}));
-		} catch (...) {
-			PrintException(std::current_exception());
+/**
+ * Walks a cgroup tree with several threads.  Each thread has its
+ * own queue of directories (paths relative to the root) and its own
+ * #CgroupOutput; it pushes the subdirectories it finds to its own
+ * queue, and idle threads steal work from the other queues.
+ *
+ * The queues hold paths instead of directory file descriptors
+ * because there may be many thousands of queued directories.
+ */
+class ParallelCgroupWalk {
+	const FileDescriptor root;
+
+	BlockDeviceNames &devices;
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<std::string> queue;
+
+		CgroupOutput output;
+	};
+
+	std::deque<Worker> workers;
+
+	/**
+	 * The number of directories which have been submitted but
+	 * not yet finished.
+	 */
+	std::atomic_size_t pending{0};
+
+	/**
+	 * The number of directories in all queues.  It is
+	 * incremented (while holding #idle_mutex) before a path is
+	 * pushed and decremented after it has been popped, therefore
+	 * it never underestimates the work available.
+	 */
+	std::atomic_size_t queued{0};
+
+	/**
+	 * Protects the transitions idle threads wait for: #queued
+	 * being incremented and #pending dropping to zero.
+	 */
+	std::mutex idle_mutex;
+	std::condition_variable idle_cond;
+
+public:
+	ParallelCgroupWalk(FileDescriptor _root, BlockDeviceNames &_devices,
+			   std::size_t n_workers)
+		:root(_root), devices(_devices), workers(n_workers) {}
+
+	void Submit(std::size_t worker_index, std::string &&path) {
+		++pending;
+
+		auto &w = workers[worker_index];
+
+		const std::scoped_lock idle_lock{idle_mutex};
+		++queued;
+
+		{
+			const std::scoped_lock lock{w.mutex};
+			w.queue.emplace_back(std::move(path));
 		}
+
+		idle_cond.notify_one();
 	}
 
-	return data;
+	/**
+	 * Run the walk.  Returns after all directories have been
+	 * finished.
+	 *
+	 * @return the number of threads which have walked (including
+	 * the calling thread); this is less than the number of
+	 * workers if not all threads could be created
+	 */
+	std::size_t Run(const CgroupExporterConfig &config);
+
+	/**
+	 * Write the merged output of all workers.
+	 */
+	void Write(BufferedOutputStream &os, std::size_t max_series) const;
+
+private:
+	/**
+	 * Take a directory from the worker's own queue (newest
+	 * first, for locality) or steal one from another worker
+	 * (oldest first, i.e. the largest subtrees).
+	 */
+	bool Pop(std::size_t worker_index, std::string &path) noexcept;
+
+	void RunWorker(const CgroupExporterConfig &config,
+		       std::size_t worker_index) noexcept;
+};
+
+inline void
+WalkContext::Submit(const char *name)
+{
+	std::string child{path, length};
+	if (!child.empty())
+		child.push_back('/');
+	child.append(name);
+
+	parallel->Submit(worker_index, std::move(child));
 }
 
-static auto
-CollectCgroup2(const CgroupExporterConfig &config)
+bool
+ParallelCgroupWalk::Pop(std::size_t worker_index, std::string &path) noexcept
 {
-	CgroupsData data;
+	{
+		auto &w = workers[worker_index];
+		const std::scoped_lock lock{w.mutex};
+		if (!w.queue.empty()) {
+			path = std::move(w.queue.back());
+			w.queue.pop_back();
+			--queued;
+			return true;
+		}
+	}
 
-	try {
-		WalkContext ctx(config, data);
-		ctx.DoWalk(OpenDirectory({FileDescriptor::Undefined(), "/sys/fs/cgroup"}));
-	} catch (...) {
-		PrintException(std::current_exception());
+	for (std::size_t i = 1; i < workers.size(); ++i) {
+		auto &w = workers[(worker_index + i) % workers.size()];
+		const std::scoped_lock lock{w.mutex};
+		if (!w.queue.empty()) {
+			path = std::move(w.queue.front());
+			w.queue.pop_front();
+			--queued;
+			return true;
+		}
 	}
 
-	return data;
+	return false;
 }
 
-[[gnu::pure]]
-static bool
-HasCgroup2() noexcept
+void
+ParallelCgroupWalk::RunWorker(const CgroupExporterConfig &config,
+			      std::size_t worker_index) noexcept
 {
-	struct stat st;
-	return stat("/sys/fs/cgroup/cgroup.subtree_control", &st) == 0;
-}
+	WalkContext ctx(config, devices, workers[worker_index].output,
+			Cgroup1Hierarchy::NONE);
+	ctx.parallel = this;
+	ctx.worker_index = worker_index;
 
-static auto
-CollectCgroup(const CgroupExporterConfig &config)
-{
-	return HasCgroup2()
-		? CollectCgroup2(config)
-		: CollectCgroup1(config);
-}
+	std::string path;
+	while (true) {
+		if (Pop(worker_index, path)) {
+			try {
+				ctx.SetPath(path);
+				ctx.DoWalk(OpenDirectory({root, path.empty() ? "." : path.c_str()},
+							 O_NOFOLLOW));
+			} catch (...) {
+				PrintException(std::current_exception());
+			}
 
-static void
-WriteCpuacct(BufferedOutputStream &os, std::string_view group, std::string_view type,
-	     double value)
-{
-	if (value >= 0)
-		os.Fmt("cgroup_cpu_usage{{groupname={:?},type={:?}}} {:e}\n",
-		       group, type, value);
-}
+			if (--pending == 0) {
+				/* lock the mutex so the notification
+				   cannot get lost between a waiter's
+				   predicate check and its wait */
+				const std::scoped_lock lock{idle_mutex};
+				idle_cond.notify_all();
+			}
 
-static void
-WriteMemory(BufferedOutputStream &os, std::string_view group, std::string_view type,
-	    int64_t value)
-{
-	if (value >= 0)
-		os.Fmt("cgroup_memory_usage{{groupname={:?},type={:?}}} {}\n",
-		       group, type, value);
-}
+			continue;
+		}
 
-static void
-WriteMemory(BufferedOutputStream &os, std::string_view group, std::string_view type,
-	    uint64_t value)
-{
-	os.Fmt("cgroup_memory_usage{{groupname={:?},type={:?}}} {}\n",
-	       group, type, value);
+		std::unique_lock lock{idle_mutex};
+		idle_cond.wait(lock, [this]{
+			return pending == 0 || queued > 0;
+		});
+
+		if (pending == 0)
+			break;
+	}
 }
 
-static void
-WritePids(BufferedOutputStream &os, std::string_view group, const CgroupPidsValues &pids)
+std::size_t
+ParallelCgroupWalk::Run(const CgroupExporterConfig &config)
 {
-	if (pids.current >= 0)
-		os.Fmt("cgroup_pids{{groupname={:?}}} {}\n",
-		       group, pids.current);
+	Submit(0, {});
 
-	if (pids.forks >= 0)
-		os.Fmt("cgroup_forks{{groupname={:?}}} {}\n",
-		       group, pids.forks);
-}
+	std::vector<std::thread> threads;
+	threads.reserve(workers.size() - 1);
 
-static void
-WritePressureRatio(BufferedOutputStream &os, std::string_view group,
-		   std::string_view resource, std::string_view type,
-		   std::string_view window, double value)
-{
-	if (value >= 0)
-		os.Fmt("cgroup_pressure_ratio{{groupname={:?},resource={:?},type={:?},window={:?}}} {:e}\n",
-		       group, resource, type, window, value);
-}
+	try {
+		for (std::size_t i = 1; i < workers.size(); ++i)
+			threads.emplace_back([this, &config, i]{
+				RunWorker(config, i);
+			});
+	} catch (...) {
+		/* probably limited by "TasksMax"; continue with
+		   the threads we have */
+		PrintException(std::current_exception());
+	}
 
-static void
-WritePressureRatio(BufferedOutputStream &os, std::string_view group,
-		   std::string_view resource, std::string_view type,
-		   const PressureItemValues &values)
-{
-	WritePressureRatio(os, group, resource, type, "10"sv, values.avg10);
-	WritePressureRatio(os, group, resource, type, "60"sv, values.avg60);
-	WritePressureRatio(os, group, resource, type, "300"sv, values.avg300);
+	RunWorker(config, 0);
+
+	for (auto &i : threads)
+		i.join();
+
+	return threads.size() + 1;
 }
 
-static void
-WritePressureRatio(BufferedOutputStream &os, std::string_view group,
-		   std::string_view resource,
-		   const PressureValues &values)
+void
+ParallelCgroupWalk::Write(BufferedOutputStream &os,
+			  std::size_t max_series) const
 {
-	WritePressureRatio(os, group, resource, "some"sv, values.some);
-	WritePressureRatio(os, group, resource, "full"sv, values.full);
+	std::vector<const CgroupOutput *> outputs;
+	outputs.reserve(workers.size());
+	for (const auto &i : workers)
+		outputs.push_back(&i.output);
+
+	WriteCgroupOutput(os, outputs, max_series);
 }
 
 static void
-WritePressureStallTime(BufferedOutputStream &os, std::string_view group,
-		       std::string_view resource, std::string_view type,
-		       double value)
+CollectCgroup1(const CgroupExporterConfig &config, BlockDeviceNames &devices,
+	       CgroupOutput &output)
 {
-	if (value >= 0)
-		os.Fmt("cgroup_pressure_stall_time{{groupname={:?},resource={:?},type={:?}}} {:e}\n",
-		       group, resource, type, value);
+	static constexpr std::pair<const char *, Cgroup1Hierarchy> hierarchies[] = {
+		{"/sys/fs/cgroup/cpuacct", Cgroup1Hierarchy::CPUACCT},
+		{"/sys/fs/cgroup/memory", Cgroup1Hierarchy::MEMORY},
+		{"/sys/fs/cgroup/pids", Cgroup1Hierarchy::PIDS},
+		{"/sys/fs/cgroup/unified", Cgroup1Hierarchy::UNIFIED},
+	};
+
+	for (const auto &[mnt, hierarchy] : hierarchies) {
+		WalkContext ctx(config, devices, output, hierarchy);
+
+		try {
+			ctx.DoWalk(OpenDirectory({FileDescriptor::Undefined(), mnt}));
+		} catch (...) {
+			PrintException(std::current_exception());
+		}
+	}
 }
 
 static void
-WritePressureStallTime(BufferedOutputStream &os, std::string_view group,
-		       std::string_view resource, std::string_view type,
-		       const PressureItemValues &values)
+CollectCgroup2(const CgroupExporterConfig &config, BlockDeviceNames &devices,
+	       CgroupOutput &output)
 {
-	WritePressureStallTime(os, group, resource, type, values.stall_time);
+	try {
+		WalkContext ctx(config, devices, output, Cgroup1Hierarchy::NONE);
+		ctx.DoWalk(OpenDirectory({FileDescriptor::Undefined(), "/sys/fs/cgroup"}));
+	} catch (...) {
+		PrintException(std::current_exception());
+	}
 }
 
+/**
+ * Read the values of all cgroups in the #CgroupTree (i.e. without
+ * walking the directory tree).
+ */
 static void
-WritePressureStallTime(BufferedOutputStream &os, std::string_view group,
-		       std::string_view resource,
-		       const PressureValues &values)
+CollectCgroupTree(const CgroupExporterConfig &config, BlockDeviceNames &devices,
+		  const CgroupTree &tree, CgroupOutput &output)
 {
-	WritePressureStallTime(os, group, resource, "some"sv, values.some);
-	WritePressureStallTime(os, group, resource, "full"sv, values.full);
+	WalkContext ctx(config, devices, output, Cgroup1Hierarchy::NONE);
+
+	tree.ForEach([&ctx](std::string_view path, FileDescriptor fd){
+		ctx.SetPath(path);
+		ctx.HandleGroup(fd);
+	});
 }
 
+/**
+ * @param threads the number of threads to use; it is reduced if not
+ * all of them could be created, so the failure is not repeated on
+ * each scrape
+ */
 static void
-DumpCgroup(BufferedOutputStream &os, const CgroupsData &data)
-{
-	os.Write(R"(# HELP cgroup_cpu_usage CPU usage in seconds
-# TYPE cgroup_cpu_usage counter
-)");
-
-	for (const auto &i : data.groups) {
-		const std::string_view group = i.first;
-		const auto &cpu = i.second.cpuacct;
-		WriteCpuacct(os, group, "user"sv, cpu.user);
-		WriteCpuacct(os, group, "system"sv, cpu.system);
-		WriteCpuacct(os, group, "total"sv, cpu.usage);
-	}
-
-	os.Write(R"(# HELP cgroup_memory_usage Memory usage in bytes
-# TYPE cgroup_memory_usage gauge
-# HELP cgroup_memory_events Memory events
-# TYPE cgroup_memory_events counter
-)");
-
-	for (const auto &i : data.groups) {
-		const std::string_view group = i.first;
-		const auto &memory = i.second.memory;
-		WriteMemory(os, group, "total"sv, memory.usage);
-		WriteMemory(os, group, "swap"sv, memory.swap_usage);
-		WriteMemory(os, group, "kmem.total"sv, memory.kmem_usage);
-		WriteMemory(os, group, "memsw.total"sv, memory.memsw_usage);
-
-		for (const auto &m : memory.stat)
-			WriteMemory(os, group, m.first, m.second);
-
-		for (const auto &[name, value] : memory.events)
-			os.Fmt("cgroup_memory_events{{groupname={:?},type={:?}}} {}\n",
-			       group, name, value);
-	}
-
-	os.Write(R"(# HELP cgroup_pids Process/Thread count
-# TYPE cgroup_pids gauge
-# HELP cgroup_memory_events PIDs events
-# TYPE cgroup_memory_events counter
-)");
-
-	for (const auto &i : data.groups) {
-		const std::string_view group = i.first;
-		const auto &pids = i.second.pids;
-		WritePids(os, group, pids);
+ExportCgroup2Parallel(const CgroupExporterConfig &config,
+		      std::size_t &threads,
+		      BlockDeviceNames &devices, BufferedOutputStream &os)
+{
+	UniqueFileDescriptor root;
 
-		for (const auto &[name, value] : pids.events)
-			os.Fmt("cgroup_pids_events{{groupname={:?},type={:?}}} {}\n",
-			       group, name, value);
+	try {
+		root = OpenDirectory({FileDescriptor::Undefined(), "/sys/fs/cgroup"});
+	} catch (...) {
+		PrintException(std::current_exception());
+		WriteCgroupOutput(os, CgroupOutput{}, config.max_series_per_family);
+		return;
 	}
 
-	os.Write(R"(# HELP cgroup_pressure_ratio Pressure stall ratio
-# TYPE cgroup_pressure_ratio gauge
-)");
-
-	for (const auto &i : data.groups) {
-		const std::string_view group = i.first;
-		WritePressureRatio(os, group, "cpu"sv, i.second.cpu_pressure);
-		WritePressureRatio(os, group, "io"sv, i.second.io_pressure);
-		WritePressureRatio(os, group, "memory"sv, i.second.memory_pressure);
+	ParallelCgroupWalk walk{root, devices, threads};
+	if (const std::size_t n = walk.Run(config); n < threads) {
+		fmt::print(stderr, "Walking the cgroup tree with {} thread(s) from now on\n", n);
+		threads = n;
 	}
 
-	os.Write(R"(# HELP cgroup_pressure_stall_time Pressure stall time
-# TYPE cgroup_pressure_stall_time counter
-)");
+	walk.Write(os, config.max_series_per_family);
+}
 
-	for (const auto &i : data.groups) {
-		const std::string_view group = i.first;
-		WritePressureStallTime(os, group, "cpu"sv, i.second.cpu_pressure);
-		WritePressureStallTime(os, group, "io"sv, i.second.io_pressure);
-		WritePressureStallTime(os, group, "memory"sv, i.second.memory_pressure);
-	}
+[[gnu::pure]]
+static bool
+HasCgroup2() noexcept
+{
+	struct stat st;
+	return stat("/sys/fs/cgroup/cgroup.subtree_control", &st) == 0;
 }
 
+/**
+ * The walk renders all samples into per-family buffers (see
+ * #CgroupOutput) which are then copied to the stream; there is no
+ * intermediate representation of the whole cgroup tree.
+ */
 static void
-ExportCgroup(const CgroupExporterConfig &config, BufferedOutputStream &os)
+ExportCgroup(const CgroupExporterConfig &config, std::size_t &threads,
+	     BlockDeviceNames &devices,
+	     CgroupTree *tree, BufferedOutputStream &os)
 {
-	DumpCgroup(os, CollectCgroup(config));
+	CgroupOutput output;
+
+	if (tree != nullptr && tree->Update()) {
+		CollectCgroupTree(config, devices, *tree, output);
+		WriteCgroupOutput(os, output, config.max_series_per_family);
+		tree->WriteStats(os);
+	} else if (!HasCgroup2()) {
+		CollectCgroup1(config, devices, output);
+		WriteCgroupOutput(os, output, config.max_series_per_family);
+	} else if (threads > 1) {
+		ExportCgroup2Parallel(config, threads, devices, os);
+	} else {
+		CollectCgroup2(config, devices, output);
+		WriteCgroupOutput(os, output, config.max_series_per_family);
+	}
 }
 
 int
@@ -522,8 +915,16 @@ try {
 
 	const auto config = LoadCgroupExporterConfig(config_file);
 
+	BlockDeviceNames devices;
+
+	std::unique_ptr<CgroupTree> tree;
+	if (config.persistent_tree && HasCgroup2())
+		tree = std::make_unique<CgroupTree>(config);
+
+	std::size_t threads = config.threads;
+
 	return RunExporter([&](BufferedOutputStream &os){
-		ExportCgroup(config, os);
+		ExportCgroup(config, threads, devices, tree.get(), os);
 	});
 } catch (...) {
 	PrintException(std::current_exception());
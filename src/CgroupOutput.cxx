@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "CgroupOutput.hxx"
+#include "io/BufferedOutputStream.hxx"
+
+#include <algorithm>
+
+using std::string_view_literals::operator""sv;
+
+struct CgroupFamilyInfo {
+	std::string_view name, help, type;
+};
+
+static constexpr CgroupFamilyInfo family_info[] = {
+	{"cgroup_cpu_usage"sv, "CPU usage in seconds"sv, "counter"sv},
+	{"cgroup_cpu_throttled_periods"sv, "Number of periods in which the cgroup was throttled"sv, "counter"sv},
+	{"cgroup_cpu_throttled_time"sv, "Time throttled in seconds"sv, "counter"sv},
+	{"cgroup_memory_usage"sv, "Memory usage in bytes"sv, "gauge"sv},
+	{"cgroup_memory_events"sv, "Memory events"sv, "counter"sv},
+	{"cgroup_memory_limit"sv, "Memory limit in bytes"sv, "gauge"sv},
+	{"cgroup_pids"sv, "Process/Thread count"sv, "gauge"sv},
+	{"cgroup_forks"sv, "Number of forks"sv, "counter"sv},
+	{"cgroup_pids_events"sv, "PIDs events"sv, "counter"sv},
+	{"cgroup_io_bytes"sv, "Bytes transferred by block I/O"sv, "counter"sv},
+	{"cgroup_io_operations"sv, "Number of block I/O operations"sv, "counter"sv},
+	{"cgroup_pressure_ratio"sv, "Pressure stall ratio"sv, "gauge"sv},
+	{"cgroup_pressure_stall_time"sv, "Pressure stall time"sv, "counter"sv},
+};
+
+static_assert(std::size(family_info) == static_cast<std::size_t>(CgroupFamily::COUNT));
+
+void
+CgroupOutput::BeginGroup(std::string_view name)
+{
+	Group &group = groups.emplace_back();
+	group.name_begin = names.size();
+	names.append(name);
+	group.name_end = names.size();
+
+	for (std::size_t f = 0; f < N_FAMILIES; ++f)
+		group.begin[f] = families[f].size();
+}
+
+std::string_view
+CgroupOutput::GetSamples(std::size_t i, std::size_t family) const noexcept
+{
+	const std::string_view buffer = families[family];
+	const std::size_t begin = groups[i].begin[family];
+	const std::size_t end = i + 1 < groups.size()
+		? groups[i + 1].begin[family]
+		: buffer.size();
+	return buffer.substr(begin, end - begin);
+}
+
+/**
+ * Split the string after the given number of lines.
+ */
+static std::pair<std::string_view, std::string_view>
+SplitLines(std::string_view s, std::size_t n) noexcept
+{
+	std::size_t position = 0;
+	while (n-- > 0) {
+		const auto newline = s.find('\n', position);
+		if (newline == s.npos)
+			return {s, {}};
+
+		position = newline + 1;
+	}
+
+	return {s.substr(0, position), s.substr(position)};
+}
+
+void
+WriteCgroupOutput(BufferedOutputStream &os,
+		  std::span<const CgroupOutput *const> outputs,
+		  std::size_t max_series)
+{
+	struct Entry {
+		std::string_view name;
+		const CgroupOutput *output;
+		std::size_t i;
+	};
+
+	std::vector<Entry> index;
+
+	std::size_t n = 0;
+	for (const auto *output : outputs)
+		n += output->groups.size();
+	index.reserve(n);
+
+	for (const auto *output : outputs)
+		for (std::size_t i = 0; i < output->groups.size(); ++i)
+			index.push_back({output->GetName(i), output, i});
+
+	std::stable_sort(index.begin(), index.end(), [](const auto &a, const auto &b){
+		return a.name < b.name;
+	});
+
+	std::array<std::size_t, CgroupOutput::N_FAMILIES> dropped{};
+
+	for (std::size_t f = 0; f < CgroupOutput::N_FAMILIES; ++f) {
+		const auto &info = family_info[f];
+		os.Fmt("# HELP {} {}\n"
+		       "# TYPE {} {}\n",
+		       info.name, info.help,
+		       info.name, info.type);
+
+		/* since the cgroups are sorted, the same series are
+		   dropped on each scrape */
+		std::size_t remaining = max_series;
+
+		for (const auto &i : index) {
+			const auto samples = i.output->GetSamples(i.i, f);
+			if (samples.empty())
+				continue;
+
+			if (max_series == 0) {
+				os.Write(samples);
+				continue;
+			}
+
+			const auto [head, tail] = SplitLines(samples, remaining);
+			if (!head.empty()) {
+				os.Write(head);
+				remaining -= std::count(head.begin(), head.end(), '\n');
+			}
+
+			dropped[f] += std::count(tail.begin(), tail.end(), '\n');
+		}
+	}
+
+	if (max_series > 0) {
+		os.Write(R"(# HELP cgroup_exporter_dropped_series Number of series omitted from this scrape due to "max_series_per_family"
+# TYPE cgroup_exporter_dropped_series gauge
+)");
+
+		for (std::size_t f = 0; f < CgroupOutput::N_FAMILIES; ++f)
+			os.Fmt("cgroup_exporter_dropped_series{{family={:?}}} {}\n",
+			       family_info[f].name, dropped[f]);
+	}
+}
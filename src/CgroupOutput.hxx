@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <fmt/format.h>
+
+#include <array>
+#include <cstdint>
+#include <iterator> // for std::back_inserter()
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class BufferedOutputStream;
+
+/**
+ * The metric families of the cgroup exporter.
+ */
+enum class CgroupFamily : uint_least8_t {
+	CPU_USAGE,
+	CPU_THROTTLED_PERIODS,
+	CPU_THROTTLED_TIME,
+	MEMORY_USAGE,
+	MEMORY_EVENTS,
+	MEMORY_LIMIT,
+	PIDS,
+	FORKS,
+	PIDS_EVENTS,
+	IO_BYTES,
+	IO_OPERATIONS,
+	PRESSURE_RATIO,
+	PRESSURE_STALL_TIME,
+
+	COUNT
+};
+
+/**
+ * Receives the samples of a cgroup walk, already rendered as text,
+ * in one buffer per metric family.  The samples of one cgroup are
+ * contiguous within each buffer, therefore a small index of buffer
+ * offsets is enough to emit them sorted by cgroup name later; no
+ * per-cgroup values need to be kept.
+ *
+ * Each walker thread has its own instance.
+ */
+class CgroupOutput {
+	static constexpr std::size_t N_FAMILIES = static_cast<std::size_t>(CgroupFamily::COUNT);
+
+	std::array<std::string, N_FAMILIES> families;
+
+	/**
+	 * The names of all cgroups, referenced by #Group.
+	 */
+	std::string names;
+
+	struct Group {
+		uint_least32_t name_begin, name_end;
+
+		/**
+		 * Where this cgroup's samples begin in each of
+		 * #families; they end where the next group's begin.
+		 */
+		std::array<uint_least32_t, N_FAMILIES> begin;
+	};
+
+	std::vector<Group> groups;
+
+public:
+	/**
+	 * Start a new cgroup.  All samples written until the next
+	 * BeginGroup() call belong to it.
+	 */
+	void BeginGroup(std::string_view name);
+
+	template<typename... Args>
+	void Fmt(CgroupFamily family, fmt::format_string<Args...> format_str,
+		 Args&&... args) {
+		fmt::format_to(std::back_inserter(families[static_cast<std::size_t>(family)]),
+			       format_str, std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Write all families (with their HELP/TYPE headers) to the
+	 * stream.  Within each family, the cgroups of all outputs are
+	 * sorted by name; a cgroup which appears more than once
+	 * (e.g. in several cgroup1 hierarchies) yields adjacent
+	 * samples.
+	 *
+	 * @param max_series the maximum number of samples per family
+	 * (0 means unlimited); excess samples are dropped and counted
+	 * in "cgroup_exporter_dropped_series"
+	 */
+	friend void WriteCgroupOutput(BufferedOutputStream &os,
+				      std::span<const CgroupOutput *const> outputs,
+				      std::size_t max_series);
+
+private:
+	[[gnu::pure]]
+	std::string_view GetName(std::size_t i) const noexcept {
+		const auto &group = groups[i];
+		return std::string_view{names}.substr(group.name_begin,
+						       group.name_end - group.name_begin);
+	}
+
+	[[gnu::pure]]
+	std::string_view GetSamples(std::size_t i, std::size_t family) const noexcept;
+};
+
+void
+WriteCgroupOutput(BufferedOutputStream &os,
+		  std::span<const CgroupOutput *const> outputs,
+		  std::size_t max_series);
+
+inline void
+WriteCgroupOutput(BufferedOutputStream &os, const CgroupOutput &output,
+		  std::size_t max_series)
+{
+	const CgroupOutput *const outputs[]{&output};
+	WriteCgroupOutput(os, outputs, max_series);
+}
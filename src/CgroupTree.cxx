@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "CgroupTree.hxx"
+#include "CgroupConfig.hxx"
+#include "DirentReader.hxx"
+#include "system/Error.hxx"
+#include "io/BufferedOutputStream.hxx"
+#include "util/PrintException.hxx"
+#include "util/SpanCast.hxx"
+
+#include <fmt/format.h>
+
+#include <cerrno>
+
+#include <sys/inotify.h>
+#include <sys/resource.h>
+
+using std::string_view_literals::operator""sv;
+
+static constexpr uint32_t WATCH_MASK =
+	IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR|IN_DONT_FOLLOW;
+
+/**
+ * Determine how many file descriptors the tree may use, leaving
+ * some for everything else.
+ */
+static std::size_t
+GetMaxFds() noexcept
+{
+	static constexpr std::size_t RESERVED_FDS = 512;
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur == RLIM_INFINITY)
+		return 0;
+
+	return rl.rlim_cur > RESERVED_FDS ? rl.rlim_cur - RESERVED_FDS : 0;
+}
+
+CgroupTree::CgroupTree(const CgroupExporterConfig &_config)
+	:config(_config), max_fds(GetMaxFds())
+{
+	if (!root.Open("/sys/fs/cgroup", O_PATH|O_DIRECTORY))
+		throw MakeErrno("Failed to open /sys/fs/cgroup");
+}
+
+CgroupTree::~CgroupTree() noexcept = default;
+
+void
+CgroupTree::Clear() noexcept
+{
+	/* closing the inotify descriptor removes all watches */
+	inotify_fd.Close();
+	watches.clear();
+	nodes.clear();
+	n_fds = 0;
+}
+
+void
+CgroupTree::Rebuild()
+{
+	Clear();
+
+	inotify_fd = UniqueFileDescriptor{AdoptTag{}, inotify_init1(IN_NONBLOCK|IN_CLOEXEC)};
+	if (!inotify_fd.IsDefined())
+		throw MakeErrno("inotify_init1() failed");
+
+	invalid = false;
+	AddSubtree(std::string{});
+}
+
+void
+CgroupTree::AddSubtree(const std::string &path)
+{
+	if (nodes.contains(path))
+		return;
+
+	const char *const relative = path.empty() ? "." : path.c_str();
+
+	UniqueFileDescriptor directory;
+	if (!directory.Open({root, relative}, O_RDONLY|O_DIRECTORY|O_NOFOLLOW)) {
+		if (errno == ENOENT)
+			/* already deleted */
+			return;
+
+		throw MakeErrno("Failed to open cgroup");
+	}
+
+	Node node;
+
+	if (n_fds < max_fds &&
+	    node.fd.Open({root, relative}, O_PATH|O_DIRECTORY|O_NOFOLLOW))
+		++n_fds;
+
+	const bool opaque = config.opaque_paths.contains(path);
+	if (!opaque) {
+		/* register the watch before reading the directory,
+		   or we might miss new children */
+		const auto absolute = fmt::format("/sys/fs/cgroup/{}"sv, path);
+		node.wd = inotify_add_watch(inotify_fd.Get(), absolute.c_str(),
+					    WATCH_MASK);
+		if (node.wd < 0)
+			throw MakeErrno("inotify_add_watch() failed");
+
+		watches[node.wd] = path;
+	}
+
+	nodes.emplace(path, std::move(node));
+
+	if (opaque)
+		return;
+
+	DirentReader r{std::move(directory)};
+
+	while (true) {
+		const auto [name, type] = r.Read();
+		if (name == nullptr)
+			break;
+
+		if (*name != '.' && !config.CheckIgnoreName(name) &&
+		    IsDirectory({r.GetFileDescriptor(), name}, type))
+			AddSubtree(path, name);
+	}
+}
+
+void
+CgroupTree::AddSubtree(std::string_view parent, const char *name)
+{
+	std::string path{parent};
+	if (!path.empty())
+		path.push_back('/');
+	path.append(name);
+
+	AddSubtree(path);
+}
+
+void
+CgroupTree::RemoveSubtree(std::string_view path) noexcept
+{
+	const auto remove = [this](auto i){
+		auto &node = i->second;
+
+		if (node.wd >= 0) {
+			/* fails if the kernel has already removed the
+			   watch, which is fine */
+			inotify_rm_watch(inotify_fd.Get(), node.wd);
+			watches.erase(node.wd);
+		}
+
+		if (node.fd.IsDefined())
+			--n_fds;
+
+		return nodes.erase(i);
+	};
+
+	if (auto i = nodes.find(path); i != nodes.end())
+		remove(i);
+
+	/* all descendants are contiguous in the sorted map */
+	const std::string prefix = fmt::format("{}/"sv, path);
+	for (auto i = nodes.lower_bound(prefix);
+	     i != nodes.end() && i->first.starts_with(prefix);)
+		i = remove(i);
+}
+
+void
+CgroupTree::HandleEvents()
+{
+	alignas(struct inotify_event) std::byte buffer[4096];
+
+	while (true) {
+		const auto nbytes = inotify_fd.Read(buffer);
+		if (nbytes < 0) {
+			if (errno == EAGAIN)
+				break;
+
+			throw MakeErrno("Failed to read inotify events");
+		}
+
+		for (std::size_t position = 0; position < static_cast<std::size_t>(nbytes);) {
+			const auto &event = *reinterpret_cast<const struct inotify_event *>(buffer + position);
+			position += sizeof(event) + event.len;
+
+			if (event.mask & IN_Q_OVERFLOW) {
+				/* events were lost; start over */
+				invalid = true;
+				return;
+			}
+
+			if (!(event.mask & IN_ISDIR) || event.len == 0)
+				continue;
+
+			const auto w = watches.find(event.wd);
+			if (w == watches.end())
+				continue;
+
+			const char *name = event.name;
+
+			if (event.mask & (IN_CREATE|IN_MOVED_TO)) {
+				if (*name != '.' && !config.CheckIgnoreName(name))
+					AddSubtree(w->second, name);
+			} else if (event.mask & (IN_DELETE|IN_MOVED_FROM)) {
+				std::string path = w->second;
+				if (!path.empty())
+					path.push_back('/');
+				path.append(name);
+
+				RemoveSubtree(path);
+			}
+		}
+	}
+}
+
+bool
+CgroupTree::Update() noexcept
+{
+	if (disabled)
+		return false;
+
+	if (!invalid) {
+		try {
+			HandleEvents();
+		} catch (...) {
+			PrintException(std::current_exception());
+			invalid = true;
+		}
+	}
+
+	if (invalid) {
+		try {
+			Rebuild();
+		} catch (...) {
+			fmt::print(stderr, "Disabling the persistent cgroup tree: ");
+			PrintException(std::current_exception());
+			Clear();
+			disabled = true;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * The heap memory used by a std::string (0 if it fits into the
+ * small string buffer).
+ */
+static std::size_t
+GetHeapSize(const std::string &s) noexcept
+{
+	return s.capacity() > std::string{}.capacity()
+		? s.capacity() + 1
+		: 0;
+}
+
+std::size_t
+CgroupTree::GetMemoryUsage() const noexcept
+{
+	/* rough estimates of the per-element overhead of the
+	   containers */
+	static constexpr std::size_t MAP_NODE_OVERHEAD = 4 * sizeof(void *);
+	static constexpr std::size_t HASH_NODE_OVERHEAD = 2 * sizeof(void *);
+
+	std::size_t size = 0;
+
+	for (const auto &[path, node] : nodes)
+		size += MAP_NODE_OVERHEAD + sizeof(std::pair<const std::string, Node>) +
+			GetHeapSize(path);
+
+	for (const auto &[wd, path] : watches)
+		size += HASH_NODE_OVERHEAD + sizeof(std::pair<const int, std::string>) +
+			GetHeapSize(path);
+
+	size += watches.bucket_count() * sizeof(void *);
+
+	return size;
+}
+
+void
+CgroupTree::WriteStats(BufferedOutputStream &os) const
+{
+	os.Fmt(R"(# HELP cgroup_exporter_tree_nodes Number of cgroups in the persistent tree
+# TYPE cgroup_exporter_tree_nodes gauge
+cgroup_exporter_tree_nodes {}
+# HELP cgroup_exporter_tree_fds Number of file descriptors held by the persistent tree
+# TYPE cgroup_exporter_tree_fds gauge
+cgroup_exporter_tree_fds {}
+# HELP cgroup_exporter_tree_watches Number of inotify watches of the persistent tree
+# TYPE cgroup_exporter_tree_watches gauge
+cgroup_exporter_tree_watches {}
+# HELP cgroup_exporter_tree_memory_bytes Estimated heap memory used by the persistent tree
+# TYPE cgroup_exporter_tree_memory_bytes gauge
+cgroup_exporter_tree_memory_bytes {}
+)",
+	       nodes.size(), n_fds, watches.size(), GetMemoryUsage());
+}
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <fcntl.h>
+
+struct CgroupExporterConfig;
+class BufferedOutputStream;
+
+/**
+ * A persistent copy of the cgroup2 directory tree.  It keeps an
+ * O_PATH file descriptor for each cgroup and learns about new and
+ * removed cgroups via inotify, so a scrape does not need to walk
+ * the whole tree again.
+ */
+class CgroupTree {
+	const CgroupExporterConfig &config;
+
+	/**
+	 * An O_PATH descriptor of /sys/fs/cgroup.
+	 */
+	UniqueFileDescriptor root;
+
+	UniqueFileDescriptor inotify_fd;
+
+	struct Node {
+		/**
+		 * An O_PATH descriptor of this cgroup directory;
+		 * undefined if we ran out of file descriptors (the
+		 * directory will then be opened by its path).
+		 */
+		UniqueFileDescriptor fd;
+
+		/**
+		 * The inotify watch descriptor; -1 if this cgroup's
+		 * children are not tracked (opaque).
+		 */
+		int wd = -1;
+	};
+
+	/**
+	 * Key is the path relative to /sys/fs/cgroup ("" for the
+	 * root cgroup).
+	 */
+	std::map<std::string, Node, std::less<>> nodes;
+
+	/**
+	 * Maps inotify watch descriptors to #nodes keys.
+	 */
+	std::unordered_map<int, std::string> watches;
+
+	/**
+	 * The number of file descriptors we may keep open in #nodes.
+	 */
+	std::size_t max_fds;
+
+	std::size_t n_fds = 0;
+
+	/**
+	 * Set if inotify events were lost; the tree will be rebuilt
+	 * on the next Update().
+	 */
+	bool invalid = true;
+
+	/**
+	 * Set if the tree could not be built (e.g. because the
+	 * inotify watch limit was reached).  It will not be tried
+	 * again.
+	 */
+	bool disabled = false;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	explicit CgroupTree(const CgroupExporterConfig &_config);
+
+	~CgroupTree() noexcept;
+
+	CgroupTree(const CgroupTree &) = delete;
+	CgroupTree &operator=(const CgroupTree &) = delete;
+
+	/**
+	 * Apply all pending inotify events to the tree.  Call this
+	 * before each scrape.
+	 *
+	 * @return false if the tree is unusable (the caller should
+	 * fall back to walking the directory tree)
+	 */
+	bool Update() noexcept;
+
+	/**
+	 * Invoke the function for each tracked cgroup with its
+	 * relative path and a directory descriptor (which may be
+	 * O_PATH).
+	 */
+	void ForEach(auto &&f) const {
+		for (const auto &[path, node] : nodes) {
+			if (node.fd.IsDefined()) {
+				f(path, node.fd);
+			} else if (UniqueFileDescriptor fd;
+				   fd.Open({root, path.empty() ? "." : path.c_str()},
+					   O_PATH|O_DIRECTORY|O_NOFOLLOW)) {
+				f(path, fd);
+			}
+		}
+	}
+
+	void WriteStats(BufferedOutputStream &os) const;
+
+private:
+	void Clear() noexcept;
+	void Rebuild();
+
+	void AddSubtree(const std::string &path);
+	void AddSubtree(std::string_view parent, const char *name);
+	void RemoveSubtree(std::string_view path) noexcept;
+
+	void HandleEvents();
+
+	/**
+	 * An estimate of the heap memory used by this object.
+	 */
+	[[gnu::pure]]
+	std::size_t GetMemoryUsage() const noexcept;
+};
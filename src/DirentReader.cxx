@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "DirentReader.hxx"
+#include "io/FileName.hxx"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+DirentReader::Entry
+DirentReader::Read() noexcept
+{
+	if (position >= fill) {
+		const auto nbytes = getdents64(fd.Get(), buffer, sizeof(buffer));
+		if (nbytes <= 0)
+			return {nullptr, DT_UNKNOWN};
+
+		position = 0;
+		fill = static_cast<std::size_t>(nbytes);
+	}
+
+	const auto *d = reinterpret_cast<const struct dirent64 *>(buffer + position);
+	position += d->d_reclen;
+
+	return {d->d_name, d->d_type};
+}
+
+bool
+IsDirectory(FileAt file, unsigned char type) noexcept
+{
+	switch (type) {
+	case DT_DIR:
+		return true;
+
+	case DT_UNKNOWN:
+		/* the filesystem doesn't tell; need to stat() */
+		break;
+
+	default:
+		return false;
+	}
+
+	struct stat st;
+	return fstatat(file.directory.Get(), file.name, &st,
+		       AT_NO_AUTOMOUNT|AT_SYMLINK_NOFOLLOW) == 0 &&
+		S_ISDIR(st.st_mode);
+}
+
+std::size_t
+CountDirectoryEntries(FileDescriptor fd) noexcept
+{
+	/* a large buffer, because /proc/PID/fd may have many
+	   thousands of entries */
+	alignas(struct dirent64) std::byte buffer[32768];
+
+	std::size_t n = 0;
+
+	while (true) {
+		const auto nbytes = getdents64(fd.Get(), buffer, sizeof(buffer));
+		if (nbytes <= 0)
+			break;
+
+		for (std::size_t position = 0;
+		     position < static_cast<std::size_t>(nbytes);) {
+			const auto *d = reinterpret_cast<const struct dirent64 *>(buffer + position);
+			position += d->d_reclen;
+
+			if (!IsSpecialFilename(d->d_name))
+				++n;
+		}
+	}
+
+	return n;
+}
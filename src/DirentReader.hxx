@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "io/FileAt.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+
+#include <dirent.h>
+
+/**
+ * Like #DirectoryReader, but reads directory entries with
+ * getdents64() into a buffer and exposes the file type ("d_type")
+ * which the kernel reports with each entry, so callers don't need
+ * to stat() each entry.
+ */
+class DirentReader {
+	UniqueFileDescriptor fd;
+
+	std::size_t position = 0, fill = 0;
+
+	alignas(struct dirent64) std::byte buffer[4096];
+
+public:
+	struct Entry {
+		const char *name;
+
+		/**
+		 * One of the DT_* constants; may be DT_UNKNOWN if
+		 * the filesystem doesn't provide it.
+		 */
+		unsigned char type;
+	};
+
+	explicit DirentReader(UniqueFileDescriptor &&_fd) noexcept
+		:fd(std::move(_fd)) {}
+
+	DirentReader(const DirentReader &) = delete;
+	DirentReader &operator=(const DirentReader &) = delete;
+
+	FileDescriptor GetFileDescriptor() const noexcept {
+		return fd;
+	}
+
+	/**
+	 * Read the next directory entry.  Returns an entry with
+	 * name==nullptr at the end of the directory or on error.
+	 */
+	Entry Read() noexcept;
+};
+
+/**
+ * Is this directory entry a directory?  Uses the d_type from
+ * #DirentReader and falls back to fstatat() only for DT_UNKNOWN.
+ */
+[[gnu::pure]]
+bool
+IsDirectory(FileAt file, unsigned char type) noexcept;
+
+/**
+ * Count the entries of a directory (excluding "." and "..") with
+ * large getdents64() calls, without looking at the entries any
+ * further.
+ */
+std::size_t
+CountDirectoryEntries(FileDescriptor fd) noexcept;
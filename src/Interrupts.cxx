@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Interrupts.hxx"
+#include "io/BufferedOutputStream.hxx"
+#include "io/BufferedReader.hxx"
+#include "io/FdReader.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/CharUtil.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/NumberParser.hxx"
+#include "util/StringCompare.hxx"
+#include "util/StringSplit.hxx"
+#include "util/StringStrip.hxx"
+
+#include <concepts>
+#include <cstdint>
+#include <numeric> // for std::accumulate()
+#include <span>
+#include <vector>
+
+using std::string_view_literals::operator""sv;
+
+using Aggregate = KernelExporterConfig::Aggregate;
+
+/**
+ * Parse the header line of a per-CPU table ("CPU0 CPU1 ...").
+ * Offline CPUs are omitted by the kernel, therefore the column
+ * index is not necessarily the CPU number.
+ */
+static std::vector<unsigned>
+ParseCpuHeader(std::string_view line)
+{
+	std::vector<unsigned> cpus;
+
+	for (std::string_view i : IterableSplitString(line, ' ')) {
+		unsigned cpu;
+		if (SkipPrefix(i, "CPU"sv) && ParseIntegerTo(i, cpu))
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+/**
+ * Parse up to `dest.size()` space-separated decimal columns.  This
+ * is a single forward scan over the null-terminated line without
+ * splitting it into substrings first.
+ *
+ * @param p the beginning of the columns; will be advanced to the
+ * first character after the last column
+ * @return the number of columns that were parsed
+ */
+static std::size_t
+ParseColumns(const char *&p, std::span<uint_least64_t> dest) noexcept
+{
+	std::size_t n = 0;
+
+	for (auto &value : dest) {
+		const char *q = p;
+		while (*q == ' ')
+			++q;
+
+		if (!IsDigitASCII(*q))
+			break;
+
+		uint_least64_t v = 0;
+		do {
+			v = v * 10 + static_cast<unsigned>(*q++ - '0');
+		} while (IsDigitASCII(*q));
+
+		value = v;
+		p = q;
+		++n;
+	}
+
+	return n;
+}
+
+/**
+ * Stream a per-CPU table such as /proc/interrupts line by line.
+ *
+ * @param f a callback which gets the row name (without the colon),
+ * the parsed columns and the rest of the line after the last
+ * column
+ * @return the CPU numbers of all columns (empty if the file could
+ * not be read)
+ */
+static std::vector<unsigned>
+ForEachPerCpuRow(const char *path,
+		 std::invocable<std::span<const unsigned>, std::string_view,
+				std::span<const uint_least64_t>,
+				std::string_view> auto f)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(path))
+		return {};
+
+	FdReader reader{fd};
+	BufferedReader r{reader};
+
+	const char *header = r.ReadLine();
+	if (header == nullptr)
+		return {};
+
+	auto cpus = ParseCpuHeader(header);
+	if (cpus.empty())
+		return cpus;
+
+	/* this buffer is reused for all rows */
+	std::vector<uint_least64_t> row(cpus.size());
+
+	char *line;
+	while ((line = r.ReadLine()) != nullptr) {
+		auto [name, rest] = Split(std::string_view{line}, ':');
+		name = Strip(name);
+		if (name.empty() || rest.data() == nullptr)
+			continue;
+
+		const char *p = rest.data();
+		const std::size_t n = ParseColumns(p, row);
+		if (n == 0)
+			continue;
+
+		f(cpus, name, std::span{row}.first(n), Strip(std::string_view{p}));
+	}
+
+	return cpus;
+}
+
+/**
+ * Collects per-CPU sums over all rows for #Aggregate::CPU.
+ */
+class PerCpuSums {
+	std::vector<uint_least64_t> sums;
+
+public:
+	void Add(std::span<const uint_least64_t> row) noexcept {
+		if (sums.size() < row.size())
+			sums.resize(row.size());
+
+		/* a simple loop over contiguous arrays which the
+		   compiler can vectorize */
+		for (std::size_t i = 0; i < row.size(); ++i)
+			sums[i] += row[i];
+	}
+
+	void Write(BufferedOutputStream &os, std::string_view metric,
+		   std::span<const unsigned> cpus) const {
+		for (std::size_t i = 0; i < sums.size() && i < cpus.size(); ++i)
+			os.Fmt("{}{{cpu=\"{}\"}} {}\n", metric, cpus[i], sums[i]);
+	}
+};
+
+[[gnu::pure]]
+static uint_least64_t
+Sum(std::span<const uint_least64_t> row) noexcept
+{
+	return std::accumulate(row.begin(), row.end(), uint_least64_t{});
+}
+
+/**
+ * Copy the string to the buffer, collapsing each run of spaces into
+ * a single space.
+ */
+static std::string_view
+CollapseSpaces(std::string_view src, std::span<char> buffer) noexcept
+{
+	std::size_t length = 0;
+	bool space = false;
+
+	for (const char ch : src) {
+		if (length >= buffer.size())
+			break;
+
+		if (ch == ' ') {
+			if (space)
+				continue;
+			space = true;
+		} else
+			space = false;
+
+		buffer[length++] = ch;
+	}
+
+	return {buffer.data(), length};
+}
+
+void
+ExportInterrupts(BufferedOutputStream &os, Aggregate aggregate)
+{
+	os.Write(R"(
+# HELP node_interrupts_total Interrupt details.
+# TYPE node_interrupts_total counter
+)");
+
+	PerCpuSums per_cpu;
+
+	const auto cpus = ForEachPerCpuRow("/proc/interrupts",
+					   [&os, aggregate, &per_cpu](std::span<const unsigned> _cpus,
+								      std::string_view type,
+								      std::span<const uint_least64_t> row,
+								      std::string_view tail){
+		if (row.size() < _cpus.size() && aggregate != Aggregate::IRQ)
+			/* global counters such as "ERR" and "MIS"
+			   have only one column; they cannot be
+			   attributed to a CPU */
+			return;
+
+		if (aggregate == Aggregate::CPU) {
+			per_cpu.Add(row);
+			return;
+		}
+
+		/* numbered IRQs have the columns "chip", "hwirq"
+		   and "devices"; the others only have a
+		   description */
+		std::string_view info = tail, devices{};
+		if (IsDigitASCII(type.front())) {
+			const auto [chip, rest1] = Split(tail, ' ');
+			const auto [hwirq, rest2] = Split(StripLeft(rest1), ' ');
+			if (!hwirq.empty())
+				info = tail.substr(0, hwirq.data() + hwirq.size() - tail.data());
+			else
+				info = chip;
+			devices = Strip(rest2);
+		}
+
+		char info_buffer[256];
+		info = CollapseSpaces(info, info_buffer);
+
+		if (aggregate == Aggregate::IRQ) {
+			os.Fmt("node_interrupts_total{{type={:?},info={:?},devices={:?}}} {}\n",
+			       type, info, devices, Sum(row));
+			return;
+		}
+
+		for (std::size_t i = 0; i < row.size(); ++i)
+			os.Fmt("node_interrupts_total{{cpu=\"{}\",type={:?},info={:?},devices={:?}}} {}\n",
+			       _cpus[i], type, info, devices, row[i]);
+	});
+
+	if (aggregate == Aggregate::CPU)
+		per_cpu.Write(os, "node_interrupts_total"sv, cpus);
+}
+
+void
+ExportSoftirqs(BufferedOutputStream &os, Aggregate aggregate)
+{
+	os.Write(R"(
+# HELP node_softirqs_functions_total Softirq counts per CPU.
+# TYPE node_softirqs_functions_total counter
+)");
+
+	PerCpuSums per_cpu;
+
+	const auto cpus = ForEachPerCpuRow("/proc/softirqs",
+					   [&os, aggregate, &per_cpu](std::span<const unsigned> _cpus,
+								      std::string_view type,
+								      std::span<const uint_least64_t> row,
+								      std::string_view){
+		switch (aggregate) {
+		case Aggregate::NONE:
+			for (std::size_t i = 0; i < row.size(); ++i)
+				os.Fmt("node_softirqs_functions_total{{cpu=\"{}\",type={:?}}} {}\n",
+				       _cpus[i], type, row[i]);
+			break;
+
+		case Aggregate::IRQ:
+			os.Fmt("node_softirqs_functions_total{{type={:?}}} {}\n",
+			       type, Sum(row));
+			break;
+
+		case Aggregate::CPU:
+			per_cpu.Add(row);
+			break;
+		}
+	});
+
+	if (aggregate == Aggregate::CPU)
+		per_cpu.Write(os, "node_softirqs_functions_total"sv, cpus);
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "KernelConfig.hxx"
+
+class BufferedOutputStream;
+
+/**
+ * Export /proc/interrupts.
+ */
+void
+ExportInterrupts(BufferedOutputStream &os,
+		 KernelExporterConfig::Aggregate aggregate);
+
+/**
+ * Export /proc/softirqs.
+ */
+void
+ExportSoftirqs(BufferedOutputStream &os,
+	       KernelExporterConfig::Aggregate aggregate);
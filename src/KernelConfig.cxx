@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "KernelConfig.hxx"
+#include "Yaml.hxx"
+
+#include <stdexcept>
+
+#include <unistd.h> // for access()
+
+static KernelExporterConfig::Aggregate
+ParseAggregate(const YAML::Node &node)
+{
+	const auto value = node.as<std::string>();
+	if (value == "none")
+		return KernelExporterConfig::Aggregate::NONE;
+	else if (value == "irq")
+		return KernelExporterConfig::Aggregate::IRQ;
+	else if (value == "cpu")
+		return KernelExporterConfig::Aggregate::CPU;
+	else
+		throw std::runtime_error("Aggregate must be one of 'none', 'irq', 'cpu'");
+}
+
+static auto
+LoadPressureTrigger(const YAML::Node &node)
+{
+	if (!node.IsMap())
+		throw std::runtime_error("Pressure trigger must be a map");
+
+	KernelExporterConfig::PressureTrigger trigger;
+
+	const auto path = node["path"];
+	if (!path || !path.IsScalar())
+		throw std::runtime_error("Pressure trigger without 'path'");
+
+	trigger.path = path.as<std::string>();
+
+	if (const auto type = node["type"]) {
+		trigger.type = type.as<std::string>();
+		if (trigger.type != "some" && trigger.type != "full")
+			throw std::runtime_error("Pressure trigger type must be 'some' or 'full'");
+	}
+
+	if (const auto threshold = node["threshold"])
+		trigger.threshold = threshold.as<unsigned>();
+
+	if (const auto window = node["window"])
+		trigger.window = window.as<unsigned>();
+
+	if (trigger.threshold == 0 || trigger.threshold > trigger.window)
+		throw std::runtime_error("Pressure trigger threshold must be between 1 and the window size");
+
+	return trigger;
+}
+
+static auto
+LoadKernelExporterConfig(const YAML::Node &node)
+{
+	KernelExporterConfig config;
+
+	if (!node.IsDefined() || node.IsNull())
+		return config;
+
+	if (!node.IsMap())
+		throw std::runtime_error("Configuration file must be a map");
+
+	if (const auto i = node["aggregate_interrupts"])
+		config.interrupts = ParseAggregate(i);
+
+	if (const auto i = node["aggregate_softirqs"])
+		config.softirqs = ParseAggregate(i);
+
+	const auto pts = node["pressure_triggers"];
+	if (pts && pts.IsSequence()) {
+		auto a = config.pressure_triggers.before_begin();
+		for (const auto &i : pts)
+			a = config.pressure_triggers.emplace_after(a, LoadPressureTrigger(i));
+	}
+
+	if (const auto i = node["ceph_workers"])
+		config.ceph_workers = i.as<unsigned>();
+
+	if (const auto i = node["ceph_timeout"]) {
+		const auto seconds = i.as<double>();
+		if (seconds <= 0)
+			throw std::runtime_error("'ceph_timeout' must be positive");
+
+		config.ceph_timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>{seconds});
+	}
+
+	return config;
+}
+
+KernelExporterConfig
+LoadKernelExporterConfig(const char *path)
+{
+	if (access(path, F_OK) < 0)
+		/* the configuration file is optional */
+		return {};
+
+	return LoadKernelExporterConfig(YAML::LoadFile(path));
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include <chrono>
+#include <forward_list>
+#include <string>
+
+struct KernelExporterConfig {
+	/**
+	 * How to aggregate the columns of a per-CPU table such as
+	 * /proc/interrupts or /proc/softirqs.
+	 */
+	enum class Aggregate {
+		/**
+		 * One series per row and CPU.
+		 */
+		NONE,
+
+		/**
+		 * Sum over all CPUs, one series per row (i.e. per
+		 * IRQ or per softirq type).
+		 */
+		IRQ,
+
+		/**
+		 * Sum over all rows, one series per CPU.
+		 */
+		CPU,
+	};
+
+	Aggregate interrupts = Aggregate::IRQ;
+	Aggregate softirqs = Aggregate::NONE;
+
+	/**
+	 * A PSI trigger to be registered on a pressure file, see
+	 * https://docs.kernel.org/accounting/psi.html#monitoring-for-pressure-thresholds
+	 */
+	struct PressureTrigger {
+		/**
+		 * The pressure file, e.g. "/proc/pressure/memory" or
+		 * "/sys/fs/cgroup/system.slice/io.pressure".
+		 */
+		std::string path;
+
+		/**
+		 * "some" or "full".
+		 */
+		std::string type = "some";
+
+		/**
+		 * The stall threshold within one window [us].
+		 */
+		unsigned threshold = 150000;
+
+		/**
+		 * The time window [us].  Without CAP_SYS_RESOURCE, the
+		 * kernel accepts only multiples of 2 seconds.
+		 */
+		unsigned window = 2000000;
+	};
+
+	/**
+	 * If not empty, then the exporter runs an event loop which
+	 * monitors these triggers in the background.
+	 */
+	std::forward_list<PressureTrigger> pressure_triggers;
+
+	/**
+	 * The number of worker threads collecting Ceph mounts in
+	 * parallel.  0 means collect them sequentially without a
+	 * deadline.
+	 */
+	unsigned ceph_workers = 0;
+
+	/**
+	 * The deadline for collecting one Ceph mount.
+	 */
+	std::chrono::steady_clock::duration ceph_timeout = std::chrono::seconds{5};
+};
+
+/**
+ * Load the configuration file.  If the file does not exist, the
+ * default configuration is returned.
+ *
+ * Throws on error.
+ */
+KernelExporterConfig
+LoadKernelExporterConfig(const char *path);
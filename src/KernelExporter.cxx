@@ -3,10 +3,16 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "Frontend.hxx"
+#include "KernelConfig.hxx"
+#include "Interrupts.hxx"
 #include "Syntax.hxx"
 #include "NumberParser.hxx"
 #include "Pressure.hxx"
 #include "CephDebugfs.hxx"
+#include "EFrontend.hxx"
+#include "PressureTrigger.hxx"
+#include "event/Loop.hxx"
+#include "event/net/PrometheusExporterHandler.hxx"
 #include "system/Error.hxx"
 #include "io/BufferedOutputStream.hxx"
 #include "io/DirectoryReader.hxx"
@@ -18,6 +24,7 @@
 #include "util/StringCompare.hxx"
 #include "util/StringSplit.hxx"
 
+#include <array>
 #include <cstdlib>
 
 #include <fcntl.h>
@@ -44,11 +51,11 @@ ReadTextFile(FileAt f, std::span<char> buffer) noexcept
         return ReadTextFile(fd, buffer);
 }
 
-static inline auto
-ParseUserHz(std::string_view text)
+static inline double
+UserHzToSeconds(uint64_t ticks)
 {
 	static const double user_hz_to_seconds = 1.0 / sysconf(_SC_CLK_TCK);
-	return ParseUint64(text) * user_hz_to_seconds;
+	return ticks * user_hz_to_seconds;
 }
 
 static void
@@ -319,18 +326,12 @@ ExportStat(BufferedOutputStream &os, std::string_view s)
 				"guest", "guest_nice",
 			};
 
-			for (const char *mode : cpu_columns) {
-				auto [value, rest] = Split(values, ' ');
-				if (value.empty())
-					break;
-
-				values = rest;
-
-				const double seconds = ParseUserHz(value);
+			std::array<uint64_t, cpu_columns.size()> ticks;
+			const std::size_t n = ParseUnsignedFields(values, ticks);
 
+			for (std::size_t i = 0; i < n; ++i)
 				os.Fmt("node_cpu_seconds_total{{cpu={:?},mode={:?}}} {:e}\n",
-				       name, mode, seconds);
-			}
+				       name, cpu_columns[i], UserHzToSeconds(ticks[i]));
 		} else if (name == "intr"sv) {
 			auto value = Split(values, ' ').first;
 			if (!value.empty())
@@ -409,17 +410,12 @@ ExportProcNetDev(BufferedOutputStream &os, std::string_view s)
 
 		device = StripLeft(device);
 
-		for (const char *const* c = proc_net_dev_columns;
-		     *c != nullptr; ++c) {
-			const char *name = *c;
-
-			auto [value_s, rest] = Split(StripLeft(values), ' ');
-			if (value_s.empty())
-				break;
-
-			values = StripLeft(rest);
+		std::array<uint64_t, std::size(proc_net_dev_columns) - 1> numbers;
+		const std::size_t n = ParseUnsignedFields(values, numbers);
 
-			const uint64_t value = ParseUint64(value_s);
+		for (std::size_t i = 0; i < n; ++i) {
+			const char *name = proc_net_dev_columns[i];
+			const uint64_t value = numbers[i];
 
 			if (first)
 				os.Fmt(R"(# HELP node_network_{}_total Network device statistic {}.
@@ -581,14 +577,12 @@ ExportProcDiskstats(BufferedOutputStream &os, std::string_view s)
 		if (IgnoreDisk(device))
 			continue;
 
-		for (const auto &c : proc_diskstats_columns) {
-			auto [value_s, rest] = Split(StripLeft(values), ' ');
-			if (value_s.empty())
-				break;
-
-			values = StripLeft(rest);
+		std::array<uint64_t, std::size(proc_diskstats_columns)> numbers;
+		const std::size_t n = ParseUnsignedFields(values, numbers);
 
-			const uint64_t value = ParseUint64(value_s);
+		for (std::size_t i = 0; i < n; ++i) {
+			const auto &c = proc_diskstats_columns[i];
+			const uint64_t value = numbers[i];
 
 			if (first)
 				os.Fmt(R"(# HELP node_disk_{} {}
@@ -714,7 +708,8 @@ ip_vs_outgoing_bytes {}
 }
 
 static void
-ExportKernel(BufferedOutputStream &os)
+ExportKernel(const KernelExporterConfig &config, CephCollector &ceph,
+	     BufferedOutputStream &os)
 {
 	ExportOopsWarnCounters(os);
 	ExportHungTasks(os);
@@ -727,20 +722,72 @@ ExportKernel(BufferedOutputStream &os)
 	Export<8192>(os, "/proc/net/snmp", ExportProcNetSnmp);
 	Export<8192>(os, "/proc/net/netstat", ExportProcNetSnmp);
 	Export<16384>(os, "/proc/diskstats", ExportProcDiskstats);
+	ExportInterrupts(os, config.interrupts);
+	ExportSoftirqs(os, config.softirqs);
 	ExportPressure(os);
 	ExportIpVs(os);
-	ExportCeph(os);
+	ceph.Export(os);
 }
 
+/**
+ * The exporter implementation used when there are background
+ * monitors (e.g. PSI triggers) which need an event loop.
+ */
+class KernelExporter final : public PrometheusExporterHandler {
+	const KernelExporterConfig &config;
+
+	CephCollector &ceph;
+
+	PressureTriggers pressure_triggers;
+
+public:
+	KernelExporter(EventLoop &event_loop,
+		       const KernelExporterConfig &_config,
+		       CephCollector &_ceph) noexcept
+		:config(_config), ceph(_ceph),
+		 pressure_triggers(event_loop, config.pressure_triggers) {}
+
+	// virtual methods from class PrometheusExporterHandler
+	std::string OnPrometheusExporterRequest() override {
+		StringOutputStream sos;
+		BufferedOutputStream bos(sos);
+		ExportKernel(config, ceph, bos);
+		pressure_triggers.Write(bos);
+		bos.Flush();
+		return sos.GetValue();
+	}
+
+	void OnPrometheusExporterError(std::exception_ptr error) noexcept override {
+		PrintException(std::move(error));
+	}
+};
+
 int
 main(int argc, char **argv) noexcept
 try {
-	if (argc > 1) {
-		fmt::print(stderr, "Usage: {}\n", argv[0]);
+	const char *config_file = "/etc/cm4all/prometheus-exporters/kernel.yml";
+	if (argc >= 2)
+		config_file = argv[1];
+
+	if (argc > 2) {
+		fmt::print(stderr, "Usage: {} [CONFIGFILE]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	return RunExporter(ExportKernel);
+	const auto config = LoadKernelExporterConfig(config_file);
+
+	CephCollector ceph{config.ceph_workers, config.ceph_timeout};
+
+	if (!config.pressure_triggers.empty() && sd_listen_fds(false) > 0) {
+		EventLoop event_loop;
+		KernelExporter kernel_exporter{event_loop, config, ceph};
+		EFrontend frontend{event_loop, kernel_exporter};
+		return frontend.Run(event_loop);
+	}
+
+	return RunExporter([&](BufferedOutputStream &os){
+		ExportKernel(config, ceph, os);
+	});
 } catch (...) {
 	PrintException(std::current_exception());
 	return EXIT_FAILURE;
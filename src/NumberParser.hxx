@@ -8,8 +8,11 @@
 #include "util/StringSplit.hxx"
 #include "util/StringStrip.hxx"
 
-#include <cmath>
+#include <bit>
+#include <charconv>
 #include <cstdint>
+#include <cstring> // for std::memcpy()
+#include <span>
 #include <string_view>
 #include <utility>
 
@@ -52,12 +55,171 @@ ParseUint64(std::string_view text) noexcept
 	return ParseUnsignedT<uint64_t>(text);
 }
 
+namespace NumberParserDetail {
+
+/**
+ * Load 8 bytes as a little-endian integer.
+ */
+[[gnu::pure]]
+inline uint64_t
+LoadEightBytes(const char *p) noexcept
+{
+	uint64_t value;
+	std::memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/**
+ * Are all 8 bytes ASCII digits?
+ */
+[[gnu::const]]
+constexpr bool
+IsEightDigits(uint64_t value) noexcept
+{
+	return ((value & 0xf0f0f0f0f0f0f0f0) |
+		(((value + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4)) ==
+		0x3333333333333333;
+}
+
+/**
+ * Convert 8 ASCII digits (loaded with LoadEightBytes()) to an
+ * integer with three multiplications instead of eight.
+ */
+[[gnu::const]]
+constexpr uint64_t
+ParseEightDigits(uint64_t value) noexcept
+{
+	constexpr uint64_t mask = 0x000000ff000000ff;
+	constexpr uint64_t mul1 = 0x000f424000000064; // 100 + (1000000ULL << 32)
+	constexpr uint64_t mul2 = 0x0000271000000001; // 1 + (10000ULL << 32)
+	value -= 0x3030303030303030;
+	value = (value * 10) + (value >> 8); // value = (value * 2561) >> 8;
+	value = (((value & mask) * mul1) + (((value >> 16) & mask) * mul2)) >> 32;
+	return static_cast<uint32_t>(value);
+}
+
+} // namespace NumberParserDetail
+
+/**
+ * Parse the unsigned integer at the beginning of the given string
+ * (after skipping spaces) and remove the whole field (up to the next
+ * space) from the string.  Non-digit characters inside the field end
+ * the number, just like ParseUnsignedT() does.
+ *
+ * This is meant for the space-separated number tables in /proc;
+ * long numbers are converted 8 digits at a time.
+ */
+inline uint64_t
+ParseUnsignedField(std::string_view &text) noexcept
+{
+	const char *p = text.data(), *const end = p + text.size();
+
+	while (p != end && *p == ' ')
+		++p;
+
+	uint64_t value = 0;
+
+	if constexpr (std::endian::native == std::endian::little) {
+		using namespace NumberParserDetail;
+
+		while (end - p >= 8) {
+			const uint64_t chunk = LoadEightBytes(p);
+			if (!IsEightDigits(chunk))
+				break;
+
+			value = value * 100000000 + ParseEightDigits(chunk);
+			p += 8;
+		}
+	}
+
+	for (; p != end && IsDigitASCII(*p); ++p)
+		value = value * 10 + uint64_t(*p - '0');
+
+	/* skip the rest of this field */
+	if (p != end && *p != ' ') {
+		const void *space = std::memchr(p, ' ', end - p);
+		p = space != nullptr ? static_cast<const char *>(space) : end;
+	}
+
+	text = {p, end};
+	return value;
+}
+
+/**
+ * Remove the given number of space-separated fields from the
+ * beginning of the string.
+ */
+inline void
+SkipFields(std::string_view &text, std::size_t n) noexcept
+{
+	const char *p = text.data(), *const end = p + text.size();
+
+	for (; n > 0; --n) {
+		while (p != end && *p == ' ')
+			++p;
+
+		const void *space = std::memchr(p, ' ', end - p);
+		if (space == nullptr) {
+			p = end;
+			break;
+		}
+
+		p = static_cast<const char *>(space);
+	}
+
+	text = {p, end};
+}
+
+/**
+ * Parse up to `values.size()` space-separated unsigned integers in
+ * one pass and remove them from the string.
+ *
+ * @return the number of fields which were found; the remaining
+ * elements of #values are left untouched
+ */
+inline std::size_t
+ParseUnsignedFields(std::string_view &text, std::span<uint64_t> values) noexcept
+{
+	std::size_t n = 0;
+
+	for (auto &value : values) {
+		text = StripLeft(text);
+		if (text.empty())
+			break;
+
+		value = ParseUnsignedField(text);
+		++n;
+	}
+
+	return n;
+}
+
+/**
+ * Parse a decimal floating point number (with optional sign and
+ * exponent), correctly rounded.  Trailing garbage is ignored.
+ *
+ * @return the number or 0 if the string does not begin with one
+ * (or if it is out of range)
+ */
 [[gnu::pure]]
 inline double
 ParseDouble(std::string_view text) noexcept
 {
-	const auto [a, b] = Split(text, '.');
+	text = StripLeft(text);
+
+	/* std::from_chars() does not accept an explicit plus sign */
+	if (text.starts_with('+')) {
+		text.remove_prefix(1);
+
+		/* ... but it must not see a second sign */
+		if (text.starts_with('-'))
+			return 0;
+	}
+
+	double value;
+	if (std::from_chars(text.data(), text.data() + text.size(),
+			    value).ec != std::errc{})
+		return 0;
 
-	return (double)ParseUint64(a) +
-		(double)ParseUint64(b) * pow(10, -(double)b.size());
+	return value;
 }
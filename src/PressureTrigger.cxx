@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "PressureTrigger.hxx"
+#include "Pressure.hxx"
+#include "system/Error.hxx"
+#include "io/BufferedOutputStream.hxx"
+#include "util/PrintException.hxx"
+#include "util/SpanCast.hxx"
+
+#include <fmt/format.h>
+
+#include <chrono>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+PressureTriggerMonitor::PressureTriggerMonitor(EventLoop &event_loop,
+					       const KernelExporterConfig::PressureTrigger &_config)
+	:config(_config),
+	 event(event_loop, BIND_THIS_METHOD(OnEvent)),
+	 burst_timer(event_loop, BIND_THIS_METHOD(OnBurstTimer))
+{
+	if (!fd.Open(config.path.c_str(), O_RDWR|O_NONBLOCK))
+		throw MakeErrno("Failed to open pressure file");
+
+	/* the kernel expects the null terminator */
+	const auto trigger = fmt::format("{} {} {}", config.type,
+					 config.threshold, config.window);
+	if (fd.Write(AsBytes(std::string_view{trigger.c_str(), trigger.size() + 1})) < 0)
+		throw MakeErrno("Failed to register PSI trigger");
+
+	event.Open(fd);
+
+	/* the pressure file always reports EPOLLIN|EPOLLOUT; only
+	   EPOLLPRI signals a trigger event */
+	event.Schedule(EPOLLPRI);
+}
+
+inline double
+PressureTriggerMonitor::ReadTotal() const noexcept
+try {
+	const auto values = ReadPressureFile(config.path.c_str());
+	return config.type == "full"
+		? values.full.stall_time
+		: values.some.stall_time;
+} catch (...) {
+	return -1;
+}
+
+void
+PressureTriggerMonitor::OnEvent(unsigned events) noexcept
+{
+	if (events & EPOLLERR) {
+		/* the cgroup was deleted; there will never be
+		   another event */
+		fmt::print(stderr, "PSI trigger on {:?} failed\n", config.path);
+		event.Cancel();
+		burst_timer.Cancel();
+		return;
+	}
+
+	if (!(events & EPOLLPRI))
+		return;
+
+	++n_events;
+
+	if (burst_start < 0) {
+		/* a new burst: at least "threshold" microseconds
+		   have already been stalled within this window */
+		const double total = ReadTotal();
+		if (total >= 0)
+			burst_start = total - config.threshold * 1e-6;
+	}
+
+	/* the kernel reports at most one event per window; if
+	   there is none within the next window, the burst is
+	   over */
+	burst_timer.Schedule(std::chrono::microseconds{config.window});
+}
+
+void
+PressureTriggerMonitor::OnBurstTimer() noexcept
+{
+	if (burst_start < 0)
+		return;
+
+	const double total = ReadTotal();
+	if (total < 0) {
+		burst_start = -1;
+		return;
+	}
+
+	double duration = total - burst_start;
+	if (duration < 0)
+		duration = 0;
+
+	burst_start = -1;
+
+	std::size_t i = 0;
+	while (i < burst_buckets.size() && duration > burst_buckets[i])
+		++i;
+
+	++burst_histogram[i];
+	burst_sum += duration;
+}
+
+void
+PressureTriggerMonitor::Write(BufferedOutputStream &os) const
+{
+	const double threshold = config.threshold * 1e-6;
+	const double window = config.window * 1e-6;
+
+	os.Fmt("pressure_trigger_events_total{{path={:?},type={:?},threshold=\"{}\",window=\"{}\"}} {}\n",
+	       config.path, config.type, threshold, window, n_events);
+
+	uint_least64_t count = 0;
+	for (std::size_t i = 0; i < burst_buckets.size(); ++i) {
+		count += burst_histogram[i];
+		os.Fmt("pressure_stall_burst_seconds_bucket{{path={:?},type={:?},threshold=\"{}\",window=\"{}\",le=\"{}\"}} {}\n",
+		       config.path, config.type, threshold, window,
+		       burst_buckets[i], count);
+	}
+
+	count += burst_histogram.back();
+
+	os.Fmt("pressure_stall_burst_seconds_bucket{{path={:?},type={:?},threshold=\"{}\",window=\"{}\",le=\"+Inf\"}} {}\n"
+	       "pressure_stall_burst_seconds_sum{{path={:?},type={:?},threshold=\"{}\",window=\"{}\"}} {:e}\n"
+	       "pressure_stall_burst_seconds_count{{path={:?},type={:?},threshold=\"{}\",window=\"{}\"}} {}\n",
+	       config.path, config.type, threshold, window, count,
+	       config.path, config.type, threshold, window, burst_sum,
+	       config.path, config.type, threshold, window, count);
+}
+
+PressureTriggers::PressureTriggers(EventLoop &event_loop,
+				   const std::forward_list<KernelExporterConfig::PressureTrigger> &config) noexcept
+{
+	for (const auto &i : config) {
+		try {
+			monitors.emplace_front(event_loop, i);
+		} catch (...) {
+			fmt::print(stderr, "Failed to register PSI trigger on {:?}: ", i.path);
+			PrintException(std::current_exception());
+		}
+	}
+}
+
+void
+PressureTriggers::Write(BufferedOutputStream &os) const
+{
+	os.Write(R"(
+# HELP pressure_trigger_events_total Number of times a PSI trigger threshold was crossed
+# TYPE pressure_trigger_events_total counter
+# HELP pressure_stall_burst_seconds Stall time accumulated during bursts of consecutive PSI trigger events
+# TYPE pressure_stall_burst_seconds histogram
+)");
+
+	for (const auto &i : monitors)
+		i.Write(os);
+}
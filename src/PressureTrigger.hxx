@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "KernelConfig.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/PipeEvent.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <array>
+#include <cstdint>
+#include <forward_list>
+
+class BufferedOutputStream;
+
+/**
+ * Registers a PSI trigger on a pressure file and counts how often
+ * it fires.  Consecutive trigger events (each within one window of
+ * the previous one) are combined into a "burst", and the stall time
+ * accumulated during each burst is recorded in a histogram.
+ */
+class PressureTriggerMonitor {
+	const KernelExporterConfig::PressureTrigger &config;
+
+	UniqueFileDescriptor fd;
+
+	PipeEvent event;
+
+	/**
+	 * Fires one window after the most recent trigger event to
+	 * finish the current burst.
+	 */
+	CoarseTimerEvent burst_timer;
+
+	/**
+	 * The "total" value [s] of the pressure file at the start of
+	 * the current burst; negative if there is no burst.
+	 */
+	double burst_start = -1;
+
+	uint_least64_t n_events = 0;
+
+	static constexpr std::array burst_buckets{
+		0.1, 0.25, 0.5, 1., 2.5, 5., 10., 30., 60.,
+	};
+
+	std::array<uint_least64_t, burst_buckets.size() + 1> burst_histogram{};
+	double burst_sum = 0;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	PressureTriggerMonitor(EventLoop &event_loop,
+			       const KernelExporterConfig::PressureTrigger &_config);
+
+	PressureTriggerMonitor(const PressureTriggerMonitor &) = delete;
+	PressureTriggerMonitor &operator=(const PressureTriggerMonitor &) = delete;
+
+	void Write(BufferedOutputStream &os) const;
+
+private:
+	/**
+	 * Read the current "total" value [s] from the pressure file.
+	 * Returns a negative value on error.
+	 */
+	double ReadTotal() const noexcept;
+
+	void OnEvent(unsigned events) noexcept;
+	void OnBurstTimer() noexcept;
+};
+
+class PressureTriggers {
+	std::forward_list<PressureTriggerMonitor> monitors;
+
+public:
+	/**
+	 * Register all configured triggers.  Triggers which cannot be
+	 * registered are logged and skipped.
+	 */
+	PressureTriggers(EventLoop &event_loop,
+			 const std::forward_list<KernelExporterConfig::PressureTrigger> &config) noexcept;
+
+	void Write(BufferedOutputStream &os) const;
+};
@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Values of a process which are expensive to read ("smaps_rollup",
+ * "io", the "fd" directory) and are therefore refreshed less often
+ * than on every scrape.
+ */
+struct ProcessSlowValues {
+	/**
+	 * Proportional set size in bytes.
+	 */
+	uint_least64_t pss = 0;
+
+	/**
+	 * Bytes read from and written to storage.
+	 */
+	uint_least64_t read_bytes = 0, write_bytes = 0;
+
+	/**
+	 * The number of open file descriptors.
+	 */
+	unsigned open_fds = 0;
+};
+
+/**
+ * The state of one process's #ProcessSlowValues: the most recent
+ * values and when each of them is due to be read again.  A
+ * default-constructed instance is due immediately.
+ */
+struct ProcessSlowState {
+	using Clock = std::chrono::steady_clock;
+
+	ProcessSlowValues values;
+
+	Clock::time_point next_smaps_rollup{}, next_io{}, next_fds{};
+};
+
+/**
+ * Remembers everything about a process which is expensive to obtain
+ * and does not need to be obtained again on every scrape:
+ *
+ * - the group name, so the "exe" link and "cmdline" need to be read
+ *   and the rules evaluated only once; processes which don't belong
+ *   to any group are remembered as well (with an empty name)
+ *
+ * - the #ProcessSlowState
+ *
+ * - the /proc/PID directory and the "stat" file, so procfs path
+ *   resolution is skipped for long-lived processes; "stat" is then
+ *   read again with pread() at offset 0.  The number of file
+ *   descriptors is bounded; processes which don't fit are opened on
+ *   each scrape.
+ *
+ * A process is identified by its pid and start time, which
+ * together survive pid reuse.  Once a process has been reaped,
+ * reading its old "stat" fails, therefore pid reuse is detected by
+ * the cached handles as well.  The "comm" is compared before using
+ * the group name, because execve() changes it, but not the pid or
+ * the start time.
+ *
+ * Get() may be called by several threads concurrently, as long as
+ * each pid is looked up by only one of them during a scan.
+ */
+class ProcessCache {
+public:
+	struct Handles {
+		/**
+		 * An O_PATH descriptor of /proc/PID.
+		 */
+		UniqueFileDescriptor directory;
+
+		UniqueFileDescriptor stat;
+	};
+
+	class Entry {
+		friend class ProcessCache;
+
+		uint_least64_t starttime = 0;
+
+		std::string comm;
+
+		/**
+		 * The group name; empty if the process does not
+		 * belong to any group.
+		 */
+		std::string name;
+
+		/**
+		 * Is #name valid for #comm?
+		 */
+		bool classified = false;
+
+		unsigned generation;
+
+	public:
+		/**
+		 * Undefined if the handles are not cached (see
+		 * ProcessCache::AddHandles()).
+		 */
+		Handles handles;
+
+		ProcessSlowState slow;
+
+		uint_least64_t GetStartTime() const noexcept {
+			return starttime;
+		}
+
+		/**
+		 * Declare which process this entry describes.  If the
+		 * start time differs, the pid has been reused, and
+		 * everything but the handles (which were already
+		 * checked by the caller) is forgotten.
+		 */
+		void SetStartTime(uint_least64_t _starttime) noexcept {
+			if (_starttime == starttime)
+				return;
+
+			starttime = _starttime;
+			classified = false;
+			slow = {};
+		}
+
+		/**
+		 * Look up the group name of the process.
+		 *
+		 * @param classify a function which determines the
+		 * group name if it is not known yet
+		 * @return the group name (empty if the process does
+		 * not belong to any group)
+		 */
+		const std::string &GetName(std::string_view _comm,
+					   std::invocable<> auto classify) {
+			if (!classified || comm != _comm) {
+				name = classify();
+				comm = _comm;
+				classified = true;
+			}
+
+			return name;
+		}
+	};
+
+private:
+	/**
+	 * Protects the structure of #items, but not the items
+	 * themselves: each item is accessed only by the thread
+	 * which looks up its pid.
+	 */
+	std::mutex mutex;
+
+	std::unordered_map<unsigned, Entry> items;
+
+	/**
+	 * The maximum number of entries with #Entry::handles (each
+	 * holds two file descriptors).
+	 */
+	const std::size_t max_handles;
+
+	/**
+	 * The number of entries with #Entry::handles.
+	 */
+	std::atomic_size_t n_handles{0};
+
+	unsigned generation = 0;
+
+public:
+	/**
+	 * @param max_fds the maximum number of file descriptors to
+	 * keep open; 0 disables caching handles
+	 */
+	explicit ProcessCache(std::size_t max_fds) noexcept
+		:max_handles(max_fds / 2) {}
+
+	/**
+	 * Call this before looking up all processes.
+	 */
+	void BeginScan() noexcept {
+		++generation;
+	}
+
+	/**
+	 * Remove all processes which were not looked up since
+	 * BeginScan(), i.e. those which have exited.
+	 */
+	void EndScan() noexcept {
+		std::erase_if(items, [this](const auto &i){
+			if (i.second.generation == generation)
+				return false;
+
+			if (i.second.handles.directory.IsDefined())
+				n_handles.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		});
+	}
+
+	/**
+	 * Look up the entry of a process; a new pid gets an empty
+	 * entry.  The caller must then call Entry::SetStartTime().
+	 *
+	 * @return a reference which is valid until the next
+	 * EndScan() call
+	 */
+	Entry &Get(unsigned pid) {
+		std::unique_lock lock{mutex};
+		auto &entry = items[pid];
+
+		/* unlike iterators, references to elements of an
+		   std::unordered_map remain valid while other threads
+		   insert */
+		lock.unlock();
+
+		entry.generation = generation;
+		return entry;
+	}
+
+	/**
+	 * Move the handles of a process into its entry, if there is
+	 * room.
+	 *
+	 * @return true on success, false if the cache is full (the
+	 * parameter is left alone)
+	 */
+	bool AddHandles(Entry &entry, Handles &&handles) noexcept {
+		if (n_handles.fetch_add(1, std::memory_order_relaxed) >= max_handles) {
+			n_handles.fetch_sub(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		entry.handles = std::move(handles);
+		return true;
+	}
+
+	/**
+	 * Close the handles of a process which have become stale.
+	 */
+	void RemoveHandles(Entry &entry) noexcept {
+		entry.handles = {};
+		n_handles.fetch_sub(1, std::memory_order_relaxed);
+	}
+};
@@ -6,6 +6,9 @@
 #include "ProcessInfo.hxx"
 #include "Yaml.hxx"
 
+#include <algorithm>
+#include <span>
+
 bool
 ProcessNameConfig::Match(const ProcessInfo &info) const noexcept
 {
@@ -38,16 +41,61 @@ ProcessNameConfig::MakeName(const ProcessInfo &info) const noexcept
 	return info.exe;
 }
 
-std::string
-ProcessExporterConfig::MakeName(const ProcessInfo &info) const noexcept
+void
+ProcessExporterConfig::BuildIndex()
+{
+	for (std::size_t i = 0; i < process_names.size(); ++i) {
+		const auto &pn = process_names[i];
+
+		if (!pn.exe.empty()) {
+			for (const auto &exe : pn.exe)
+				index.by_exe[exe].push_back(i);
+		} else if (!pn.comm.empty()) {
+			for (const auto &comm : pn.comm)
+				index.by_comm[comm].push_back(i);
+		} else
+			index.other.push_back(i);
+	}
+}
+
+static std::span<const std::size_t>
+FindCandidates(const std::unordered_map<std::string, std::vector<std::size_t>> &map,
+	       const std::string &key) noexcept
 {
-	for (const auto &i : process_names)
-		if (i.Match(info))
-			return i.MakeName(info);
+	if (const auto i = map.find(key); i != map.end())
+		return i->second;
 
 	return {};
 }
 
+std::string
+ProcessExporterConfig::MakeName(const ProcessInfo &info) const noexcept
+{
+	std::span<const std::size_t> candidates[] = {
+		FindCandidates(index.by_exe, info.exe),
+		FindCandidates(index.by_comm, info.comm),
+		index.other,
+	};
+
+	/* merge the sorted candidate lists, so the rules are
+	   evaluated in configuration order */
+	while (true) {
+		std::span<const std::size_t> *next = nullptr;
+		for (auto &c : candidates)
+			if (!c.empty() && (next == nullptr || c.front() < next->front()))
+				next = &c;
+
+		if (next == nullptr)
+			return {};
+
+		const auto &pn = process_names[next->front()];
+		*next = next->subspan(1);
+
+		if (pn.Match(info))
+			return pn.MakeName(info);
+	}
+}
+
 static auto
 LoadProcessNameConfig(const YAML::Node &node)
 {
@@ -76,6 +124,16 @@ LoadProcessNameConfig(const YAML::Node &node)
 	return pn;
 }
 
+static std::chrono::steady_clock::duration
+LoadInterval(const YAML::Node &node, const char *name)
+{
+	const auto seconds = node.as<double>();
+	if (seconds < 0)
+		throw std::runtime_error(std::string{"'"} + name + "' must not be negative");
+
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>{seconds});
+}
+
 static auto
 LoadProcessExporterConfig(const YAML::Node &node)
 {
@@ -92,6 +150,41 @@ LoadProcessExporterConfig(const YAML::Node &node)
 		config.process_names.emplace_back(LoadProcessNameConfig(i));
 	}
 
+	if (const auto i = node["per_thread"])
+		config.per_thread = i.as<bool>();
+
+	if (const auto i = node["thread_context_switches"])
+		config.thread_context_switches = i.as<bool>();
+
+	if (const auto i = node["schedstat"])
+		config.schedstat = i.as<bool>();
+
+	if (const auto i = node["threads"]) {
+		config.threads = i.as<unsigned>();
+		if (config.threads < 1)
+			throw std::runtime_error("'threads' must be at least 1");
+	}
+
+	if (const auto i = node["max_cached_fds"])
+		config.max_cached_fds = i.as<std::size_t>();
+
+	if (const auto i = node["proc_connector"])
+		config.proc_connector = i.as<bool>();
+
+	if (const auto i = node["taskstats"])
+		config.taskstats = i.as<bool>();
+
+	if (const auto i = node["smaps_rollup_interval"])
+		config.smaps_rollup_interval = LoadInterval(i, "smaps_rollup_interval");
+
+	if (const auto i = node["io_interval"])
+		config.io_interval = LoadInterval(i, "io_interval");
+
+	if (const auto i = node["fd_interval"])
+		config.fd_interval = LoadInterval(i, "fd_interval");
+
+	config.BuildIndex();
+
 	return config;
 }
 
@@ -6,9 +6,13 @@
 
 #include "lib/pcre/UniqueRegex.hxx"
 
+#include <chrono>
+#include <cstddef>
 #include <forward_list>
+#include <optional>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 struct ProcessInfo;
@@ -27,6 +31,109 @@ struct ProcessNameConfig {
 struct ProcessExporterConfig {
 	std::vector<ProcessNameConfig> process_names;
 
+	/**
+	 * An index of #process_names built by BuildIndex(), so
+	 * MakeName() needs to evaluate only the rules which can
+	 * possibly match.  Each rule appears in exactly one of
+	 * these, and each list is sorted.
+	 */
+	struct {
+		/**
+		 * Rules with "exe", indexed by each of their exe
+		 * names.
+		 */
+		std::unordered_map<std::string, std::vector<std::size_t>> by_exe;
+
+		/**
+		 * Rules without "exe" but with "comm", indexed by
+		 * each of their comm names.
+		 */
+		std::unordered_map<std::string, std::vector<std::size_t>> by_comm;
+
+		/**
+		 * Rules with neither "exe" nor "comm"; these are
+		 * candidates for every process.
+		 */
+		std::vector<std::size_t> other;
+	} index;
+
+	/**
+	 * Read "stat" and "status" of each thread?  If false, then
+	 * only the process-level "stat" is read, which contains the
+	 * totals of all threads.
+	 */
+	bool per_thread = true;
+
+	/**
+	 * If #per_thread is false: read "status" of each thread
+	 * anyway for the context switch counters (which are not
+	 * aggregated by the kernel)?
+	 */
+	bool thread_context_switches = true;
+
+	/**
+	 * Read "schedstat" of each thread for the on-CPU time, run
+	 * queue wait time and timeslice count?
+	 */
+	bool schedstat = false;
+
+	/**
+	 * The number of threads scanning /proc.  1 means scan in
+	 * the main thread only.  If threads cannot be created
+	 * (e.g. because of "TasksMax"), the exporter continues with
+	 * fewer.
+	 */
+	unsigned threads = 1;
+
+	/**
+	 * The maximum number of file descriptors (two per process)
+	 * which are kept open across scrapes, so /proc/PID does not
+	 * need to be looked up again for long-lived processes.  0
+	 * disables this.  Must be well below "LimitNOFILE".
+	 */
+	std::size_t max_cached_fds = 0;
+
+	/**
+	 * Maintain the process table incrementally from the kernel's
+	 * netlink process connector instead of scanning /proc for
+	 * each scrape?  Counters of exited processes are retained,
+	 * so group counters are monotonic; the final counters of
+	 * processes which are reaped before they can be read are
+	 * obtained from the taskstats exit messages (if the kernel
+	 * supports them).  Implies process-level
+	 * "stat" (#per_thread is ignored).  Requires CAP_NET_ADMIN
+	 * and socket activation.
+	 */
+	bool proc_connector = false;
+
+	/**
+	 * Query taskstats via generic netlink for each process and
+	 * export delay accounting counters (CPU run queue, block I/O,
+	 * swapin).  Requires CAP_NET_ADMIN; block I/O and swapin
+	 * delays also require "kernel.task_delayacct=1".
+	 */
+	bool taskstats = false;
+
+	/**
+	 * How often to read "smaps_rollup" (proportional set size),
+	 * "io" (storage I/O bytes) and count the "fd" directory of
+	 * each process.  These are expensive, therefore the cached
+	 * values are exported in between.  Not set means disabled;
+	 * zero means on every scrape.
+	 */
+	std::optional<std::chrono::steady_clock::duration> smaps_rollup_interval,
+		io_interval, fd_interval;
+
+	void BuildIndex();
+
+	/**
+	 * Determine the group name of a process by evaluating the
+	 * rules in the order of #process_names; the first match
+	 * wins.
+	 *
+	 * @return the group name or an empty string if no rule
+	 * matches
+	 */
 	std::string MakeName(const ProcessInfo &info) const noexcept;
 };
 
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ProcessConnector.hxx"
+#include "system/Error.hxx"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+
+static void
+SendMulticastOp(FileDescriptor fd, enum proc_cn_mcast_op op)
+{
+	alignas(struct nlmsghdr) std::byte buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))]{};
+
+	auto *nlh = reinterpret_cast<struct nlmsghdr *>(buffer);
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	nlh->nlmsg_type = NLMSG_DONE;
+
+	auto *cn = reinterpret_cast<struct cn_msg *>(NLMSG_DATA(nlh));
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	std::memcpy(cn->data, &op, sizeof(op));
+
+	if (send(fd.Get(), buffer, nlh->nlmsg_len, 0) < 0)
+		throw MakeErrno("Failed to subscribe to process events");
+}
+
+ProcessConnector::ProcessConnector(EventLoop &event_loop,
+				   ProcessConnectorHandler &_handler)
+	:handler(_handler),
+	 event(event_loop, BIND_THIS_METHOD(OnSocketReady))
+{
+	const int s = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK,
+			     NETLINK_CONNECTOR);
+	if (s < 0)
+		throw MakeErrno("Failed to create netlink socket");
+
+	fd = UniqueFileDescriptor{AdoptTag{}, s};
+
+	/* a large receive buffer reduces the risk of losing events
+	   during fork storms; SO_RCVBUFFORCE ignores "rmem_max"
+	   (we have CAP_NET_ADMIN anyway) */
+	const int rcvbuf = 4 * 1024 * 1024;
+	if (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	struct sockaddr_nl sa{};
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = CN_IDX_PROC;
+
+	if (bind(s, reinterpret_cast<const struct sockaddr *>(&sa), sizeof(sa)) < 0)
+		throw MakeErrno("Failed to bind netlink socket");
+
+	SendMulticastOp(fd, PROC_CN_MCAST_LISTEN);
+
+	event.Open(fd);
+	event.ScheduleRead();
+}
+
+ProcessConnector::~ProcessConnector() noexcept
+{
+	event.Cancel();
+
+	if (fd.IsDefined()) {
+		/* some kernels count the listeners globally and
+		   keep broadcasting events until each one has
+		   unsubscribed */
+		try {
+			SendMulticastOp(fd, PROC_CN_MCAST_IGNORE);
+		} catch (...) {
+			/* ignore, we're shutting down anyway */
+		}
+	}
+}
+
+inline void
+ProcessConnector::HandleMessage(const void *data, std::size_t size) noexcept
+{
+	if (size < sizeof(struct cn_msg))
+		return;
+
+	const auto &cn = *static_cast<const struct cn_msg *>(data);
+	if (cn.id.idx != CN_IDX_PROC || cn.id.val != CN_VAL_PROC ||
+	    cn.len < sizeof(struct proc_event) ||
+	    size < sizeof(cn) + cn.len)
+		return;
+
+	struct proc_event ev;
+	std::memcpy(&ev, cn.data, sizeof(ev));
+
+	/* older kernel headers declare the enum inside struct
+	   proc_event, newer ones outside */
+	using What = decltype(proc_event::what);
+
+	switch (ev.what) {
+	case What::PROC_EVENT_FORK:
+		if (ev.event_data.fork.child_pid == ev.event_data.fork.child_tgid)
+			handler.OnProcessFork(ev.event_data.fork.parent_tgid,
+					      ev.event_data.fork.child_pid);
+		break;
+
+	case What::PROC_EVENT_EXEC:
+		handler.OnProcessExec(ev.event_data.exec.process_tgid);
+		break;
+
+	case What::PROC_EVENT_EXIT:
+		if (ev.event_data.exit.process_pid == ev.event_data.exit.process_tgid)
+			handler.OnProcessExit(ev.event_data.exit.process_pid);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void
+ProcessConnector::OnSocketReady(unsigned) noexcept
+{
+	alignas(struct nlmsghdr) std::byte buffer[16384];
+
+	while (true) {
+		const ssize_t nbytes = recv(fd.Get(), buffer, sizeof(buffer), 0);
+		if (nbytes < 0) {
+			if (errno == ENOBUFS) {
+				/* the kernel has dropped events */
+				handler.OnProcessConnectorOverflow();
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EINTR) {
+				event.Cancel();
+				fd.Close();
+				handler.OnProcessConnectorError(std::make_exception_ptr(MakeErrno("Failed to receive process events")));
+			}
+
+			return;
+		}
+
+		int length = nbytes;
+		for (auto *nlh = reinterpret_cast<struct nlmsghdr *>(buffer);
+		     NLMSG_OK(nlh, length); nlh = NLMSG_NEXT(nlh, length)) {
+			if (nlh->nlmsg_type == NLMSG_ERROR ||
+			    nlh->nlmsg_type == NLMSG_NOOP)
+				continue;
+
+			HandleMessage(NLMSG_DATA(nlh),
+				      nlh->nlmsg_len - NLMSG_LENGTH(0));
+		}
+	}
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "event/PipeEvent.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+#include <exception>
+
+class ProcessConnectorHandler {
+public:
+	/**
+	 * A new process was created (new threads are not reported).
+	 */
+	virtual void OnProcessFork(unsigned parent_pid, unsigned child_pid) noexcept = 0;
+
+	virtual void OnProcessExec(unsigned pid) noexcept = 0;
+
+	/**
+	 * A process has exited (exiting threads are not reported).
+	 * It may still be a zombie, i.e. its /proc directory may
+	 * still exist.
+	 */
+	virtual void OnProcessExit(unsigned pid) noexcept = 0;
+
+	/**
+	 * Events were lost because the socket's receive buffer was
+	 * full.
+	 */
+	virtual void OnProcessConnectorOverflow() noexcept = 0;
+
+	/**
+	 * The socket has failed; there will be no more events.
+	 */
+	virtual void OnProcessConnectorError(std::exception_ptr error) noexcept = 0;
+};
+
+/**
+ * Subscribes to process events (fork, exec, exit) from the kernel's
+ * netlink process connector.  This requires CAP_NET_ADMIN.
+ */
+class ProcessConnector {
+	ProcessConnectorHandler &handler;
+
+	UniqueFileDescriptor fd;
+
+	PipeEvent event;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	ProcessConnector(EventLoop &event_loop, ProcessConnectorHandler &_handler);
+
+	~ProcessConnector() noexcept;
+
+	ProcessConnector(const ProcessConnector &) = delete;
+	ProcessConnector &operator=(const ProcessConnector &) = delete;
+
+	/**
+	 * Handle all events which are pending in the socket right
+	 * now.  Call this before a scrape, so the process table is as
+	 * recent as possible.
+	 */
+	void Flush() noexcept {
+		if (fd.IsDefined())
+			OnSocketReady(0);
+	}
+
+private:
+	void HandleMessage(const void *data, std::size_t size) noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+};
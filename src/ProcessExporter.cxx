@@ -3,15 +3,24 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "Frontend.hxx"
+#include "EFrontend.hxx"
 #include "ProcessConfig.hxx"
+#include "ProcessConnector.hxx"
 #include "ProcessInfo.hxx"
 #include "ProcessIterator.hxx"
+#include "ProcessCache.hxx"
+#include "DirentReader.hxx"
+#include "Taskstats.hxx"
+#include "TaskstatsExitListener.hxx"
 #include "NumberParser.hxx"
+#include "event/Loop.hxx"
+#include "event/net/PrometheusExporterHandler.hxx"
 #include "io/BufferedOutputStream.hxx"
 #include "io/DirectoryReader.hxx"
 #include "io/FileAt.hxx"
 #include "io/SmallTextFile.hxx"
 #include "io/Open.hxx"
+#include "io/StringOutputStream.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "system/Error.hxx"
 #include "util/IterableSplitString.hxx"
@@ -19,9 +28,20 @@
 #include "util/StringCompare.hxx"
 #include "util/StringStrip.hxx"
 
+#include <fmt/format.h>
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
 #include <cstdlib>
+#include <optional>
+#include <span>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
 
 using std::string_view_literals::operator""sv;
 
@@ -71,6 +91,8 @@ struct ProcessStat {
 	unsigned long minflt = 0, majflt = 0;
 	unsigned long utime = 0, stime = 0;
 	unsigned long vsize = 0, rss = 0;
+	unsigned num_threads = 0;
+	uint_least64_t starttime = 0;
 };
 
 static auto
@@ -82,64 +104,138 @@ ParseProcessStat(std::string_view text)
 
 	std::tie(s, text) = Split(text, ' '); // pid
 
-	std::tie(s, text) = Split(text, ' '); // comm
-	if (!s.empty() && s.front() == '(' && s.back() == ')') {
-		s = s.substr(1, s.size() - 2);
-	}
+	/* comm may contain spaces and parentheses; it ends at the
+	   last closing parenthesis */
+	if (!SkipPrefix(text, "("sv))
+		return result;
 
-	result.comm = s;
+	std::tie(result.comm, text) = SplitLast(text, ')');
+	text = StripLeft(text);
 
 	std::tie(s, text) = Split(text, ' '); // state
 	if (!s.empty())
 		result.state = s.front();
 
-	std::tie(s, text) = Split(text, ' '); // ppid
-	std::tie(s, text) = Split(text, ' '); // pgrp
-	std::tie(s, text) = Split(text, ' '); // session
-	std::tie(s, text) = Split(text, ' '); // tty_nr
-	std::tie(s, text) = Split(text, ' '); // tpgid
-	std::tie(s, text) = Split(text, ' '); // flags
+	SkipFields(text, 6); // ppid pgrp session tty_nr tpgid flags
+
+	/* negative fields (priority, nice) are parsed as 0, but we
+	   don't need them */
+	enum {
+		MINFLT, CMINFLT, MAJFLT, CMAJFLT,
+		UTIME, STIME, CUTIME, CSTIME,
+		PRIORITY, NICE, NUM_THREADS, ITREALVALUE,
+		STARTTIME, VSIZE, RSS,
+		N_FIELDS
+	};
+
+	std::array<uint64_t, N_FIELDS> fields{};
+	ParseUnsignedFields(text, fields);
+
+	result.minflt = fields[MINFLT];
+	result.majflt = fields[MAJFLT];
+	result.utime = fields[UTIME];
+	result.stime = fields[STIME];
+	result.num_threads = fields[NUM_THREADS];
+	result.starttime = fields[STARTTIME];
+	result.vsize = fields[VSIZE];
+	result.rss = fields[RSS];
+
+	return result;
+}
 
-	std::tie(s, text) = Split(text, ' '); // minflt
-	result.minflt = ParseUnsignedLong(s);
+struct ProcessSchedstat {
+	/**
+	 * Time spent on the CPU in nanoseconds.
+	 */
+	uint_least64_t runtime = 0;
+
+	/**
+	 * Time spent waiting on a run queue in nanoseconds.
+	 */
+	uint_least64_t wait = 0;
+
+	/**
+	 * Number of timeslices run on a CPU.
+	 */
+	uint_least64_t timeslices = 0;
+};
 
-	std::tie(s, text) = Split(text, ' '); // cminflt
+static ProcessSchedstat
+ParseProcessSchedstat(std::string_view text)
+{
+	ProcessSchedstat result;
 
-	std::tie(s, text) = Split(text, ' '); // majflt
-	result.majflt = ParseUnsignedLong(s);
+	std::string_view s;
 
-	std::tie(s, text) = Split(text, ' '); // cmajflt
+	std::tie(s, text) = Split(Strip(text), ' ');
+	result.runtime = ParseUint64(s);
 
-	std::tie(s, text) = Split(text, ' '); // utime
-	result.utime = ParseUnsignedLong(s);
+	std::tie(s, text) = Split(text, ' ');
+	result.wait = ParseUint64(s);
 
-	std::tie(s, text) = Split(text, ' '); // stime
-	result.stime = ParseUnsignedLong(s);
+	result.timeslices = ParseUint64(text);
 
-	std::tie(s, text) = Split(text, ' '); // cutime
-	std::tie(s, text) = Split(text, ' '); // cstime
-	std::tie(s, text) = Split(text, ' '); // priority
-	std::tie(s, text) = Split(text, ' '); // nice
-	std::tie(s, text) = Split(text, ' '); // num_threads
-	std::tie(s, text) = Split(text, ' '); // itrealvalue
-	std::tie(s, text) = Split(text, ' '); // starttime
+	return result;
+}
 
-	std::tie(s, text) = Split(text, ' '); // vsize
-	result.vsize = ParseUnsignedLong(s);
+/**
+ * Parse /proc/PID/smaps_rollup.
+ *
+ * @return the proportional set size in bytes
+ */
+static uint_least64_t
+ParseSmapsRollup(std::string_view text)
+{
+	for (auto line : IterableSplitString(text, '\n')) {
+		if (SkipPrefix(line, "Pss:"sv)) {
+			line = Strip(line);
+			RemoveSuffix(line, " kB"sv);
+			return ParseUint64(Strip(line)) * 1024;
+		}
+	}
 
-	std::tie(s, text) = Split(text, ' '); // rss
-	result.rss = ParseUnsignedLong(s);
+	return 0;
+}
 
-	return result;
+/**
+ * Parse /proc/PID/io into the given #ProcessSlowValues.
+ */
+static void
+ParseProcessIo(ProcessSlowValues &values, std::string_view text)
+{
+	for (auto line : IterableSplitString(text, '\n')) {
+		if (SkipPrefix(line, "read_bytes:"sv))
+			values.read_bytes = ParseUint64(Strip(line));
+		else if (SkipPrefix(line, "write_bytes:"sv))
+			values.write_bytes = ParseUint64(Strip(line));
+	}
 }
 
 struct ProcessGroupData {
 	unsigned n_procs = 0, n_threads = 0;
-	unsigned voluntary_ctxt_switches = 0, nonvoluntary_ctxt_switches = 0;
+	unsigned long voluntary_ctxt_switches = 0, nonvoluntary_ctxt_switches = 0;
 	unsigned long minflt = 0, majflt = 0;
 	unsigned long utime = 0, stime = 0;
 	unsigned long vsize = 0, rss = 0;
 
+	/**
+	 * Delay accounting counters in nanoseconds (only if
+	 * "taskstats" is enabled).
+	 */
+	uint_least64_t cpu_delay = 0, blkio_delay = 0, swapin_delay = 0;
+
+	/**
+	 * See #ProcessSlowValues (only if the respective interval is
+	 * configured).
+	 */
+	uint_least64_t pss = 0, read_bytes = 0, write_bytes = 0;
+	unsigned long open_fds = 0;
+
+	/**
+	 * See #ProcessSchedstat (only if "schedstat" is enabled).
+	 */
+	uint_least64_t sched_runtime = 0, sched_wait = 0, sched_timeslices = 0;
+
 	auto &operator+=(const ProcessStatus &src) noexcept {
 		voluntary_ctxt_switches += src.voluntary_ctxt_switches;
 		nonvoluntary_ctxt_switches += src.nonvoluntary_ctxt_switches;
@@ -155,80 +251,591 @@ struct ProcessGroupData {
 		rss += src.rss;
 		return *this;
 	}
+
+	auto &operator+=(const TaskstatsDelays &src) noexcept {
+		cpu_delay += src.cpu;
+		blkio_delay += src.blkio;
+		swapin_delay += src.swapin;
+		return *this;
+	}
+
+	/**
+	 * Add the counters of an exited thread.
+	 */
+	auto &operator+=(const TaskstatsExit &src) noexcept {
+		static const uint_least64_t clock_ticks = sysconf(_SC_CLK_TCK);
+
+		voluntary_ctxt_switches += src.voluntary_ctxt_switches;
+		nonvoluntary_ctxt_switches += src.nonvoluntary_ctxt_switches;
+		minflt += src.minflt;
+		majflt += src.majflt;
+		utime += src.utime * clock_ticks / 1000000;
+		stime += src.stime * clock_ticks / 1000000;
+		*this += src.delays;
+		read_bytes += src.read_bytes;
+		write_bytes += src.write_bytes;
+		sched_runtime += src.run_real_total;
+		sched_wait += src.delays.cpu;
+		sched_timeslices += src.cpu_count;
+		return *this;
+	}
+
+	auto &operator+=(const ProcessSchedstat &src) noexcept {
+		sched_runtime += src.runtime;
+		sched_wait += src.wait;
+		sched_timeslices += src.timeslices;
+		return *this;
+	}
+
+	auto &operator+=(const ProcessSlowValues &src) noexcept {
+		pss += src.pss;
+		read_bytes += src.read_bytes;
+		write_bytes += src.write_bytes;
+		open_fds += src.open_fds;
+		return *this;
+	}
+
+	auto &operator+=(const ProcessGroupData &src) noexcept {
+		n_procs += src.n_procs;
+		n_threads += src.n_threads;
+		voluntary_ctxt_switches += src.voluntary_ctxt_switches;
+		nonvoluntary_ctxt_switches += src.nonvoluntary_ctxt_switches;
+		minflt += src.minflt;
+		majflt += src.majflt;
+		utime += src.utime;
+		stime += src.stime;
+		vsize += src.vsize;
+		rss += src.rss;
+		cpu_delay += src.cpu_delay;
+		blkio_delay += src.blkio_delay;
+		swapin_delay += src.swapin_delay;
+		pss += src.pss;
+		read_bytes += src.read_bytes;
+		write_bytes += src.write_bytes;
+		open_fds += src.open_fds;
+		sched_runtime += src.sched_runtime;
+		sched_wait += src.sched_wait;
+		sched_timeslices += src.sched_timeslices;
+		return *this;
+	}
 };
 
 using ProcessGroupMap = std::unordered_map<std::string, ProcessGroupData>;
 
 static void
-CollectProcess(ProcessGroupData &group, unsigned, FileDescriptor pid_fd)
+CollectProcess(ProcessGroupData &group, unsigned, FileDescriptor pid_fd,
+	       bool schedstat)
 {
 	group += WithSmallTextFile<4096>(FileAt{pid_fd, "status"},
 					 ParseProcessStatus);
 	group += WithSmallTextFile<1024>(FileAt{pid_fd, "stat"},
 					 ParseProcessStat);
+
+	if (schedstat)
+		group += WithSmallTextFile<256>(FileAt{pid_fd, "schedstat"},
+						ParseProcessSchedstat);
 }
 
-static auto
-CollectProcessGroups(const ProcessExporterConfig &config, FileDescriptor proc_fd)
+/**
+ * Collect the per-thread counters which the kernel does not
+ * aggregate in the process's "stat": the context switch counters
+ * from "status" and the scheduler statistics from "schedstat".
+ * Only these files are read from each thread.
+ */
+static void
+CollectThreadCounters(ProcessGroupData &group, FileDescriptor pid_fd,
+		      unsigned num_threads,
+		      bool context_switches, bool schedstat)
 {
-	ProcessGroupMap groups;
+	if (num_threads == 1) {
+		/* the process's own files describe its only thread;
+		   no need to walk "task" */
+		if (context_switches)
+			group += WithSmallTextFile<4096>(FileAt{pid_fd, "status"},
+							 ParseProcessStatus);
+
+		if (schedstat)
+			group += WithSmallTextFile<256>(FileAt{pid_fd, "schedstat"},
+							ParseProcessSchedstat);
+
+		return;
+	}
 
-	ForEachProcess(proc_fd, [&](unsigned, FileDescriptor pid_fd){
-		char exe[4096];
-		ssize_t rl = readlinkat(pid_fd.Get(), "exe", exe, sizeof(exe));
-		if (rl < 0 || size_t(rl) >= sizeof(exe))
-			return;
+	if (!context_switches && !schedstat)
+		return;
 
-		std::string_view name(exe, rl);
-		RemoveSuffix(name, " (deleted)"sv);
+	ForEachProcessThreadName(pid_fd, [&](FileDescriptor task_fd, const char *tid){
+		char path[64];
 
-		auto slash = SplitLast(name, '/');
-		if (slash.second.data() != nullptr)
-			name = slash.second;
+		if (context_switches) {
+			*fmt::format_to_n(path, sizeof(path) - 1, "{}/status"sv, tid).out = 0;
 
-		if (name.empty())
+			UniqueFileDescriptor fd;
+			if (!fd.OpenReadOnly({task_fd, path}))
+				/* the thread has exited meanwhile */
+				return;
+
+			group += WithSmallTextFile<4096>(fd, ParseProcessStatus);
+		}
+
+		if (schedstat) {
+			*fmt::format_to_n(path, sizeof(path) - 1, "{}/schedstat"sv, tid).out = 0;
+
+			UniqueFileDescriptor fd;
+			if (!fd.OpenReadOnly({task_fd, path}))
+				return;
+
+			group += WithSmallTextFile<256>(fd, ParseProcessSchedstat);
+		}
+	});
+}
+
+/**
+ * Determine the group name of a process from its "exe" and
+ * "cmdline" (this is the expensive part which is cached by
+ * #ProcessCache).
+ *
+ * @return the group name or an empty string if the process does not
+ * belong to any group
+ */
+static std::string
+ClassifyProcess(const ProcessExporterConfig &config, FileDescriptor pid_fd,
+		std::string_view comm)
+{
+	char exe[4096];
+	ssize_t rl = readlinkat(pid_fd.Get(), "exe", exe, sizeof(exe));
+	if (rl < 0 || size_t(rl) >= sizeof(exe))
+		return {};
+
+	std::string_view name(exe, rl);
+	RemoveSuffix(name, " (deleted)"sv);
+
+	auto slash = SplitLast(name, '/');
+	if (slash.second.data() != nullptr)
+		name = slash.second;
+
+	if (name.empty())
+		return {};
+
+	ProcessInfo info;
+	info.comm = std::string{comm};
+	info.exe = std::string{name};
+	info.cmdline = ReadTextFile<4096>(FileAt{pid_fd, "cmdline"});
+	std::replace(info.cmdline.begin(), info.cmdline.end(),
+		     '\0', ' ');
+
+	return config.MakeName(info);
+}
+
+/**
+ * Is the kernel's delay accounting enabled?  Without it, taskstats
+ * reports only the CPU (run queue) delay.
+ */
+static bool
+IsDelayAccountingEnabled() noexcept
+{
+	UniqueFileDescriptor f;
+	if (!f.OpenReadOnly("/proc/sys/kernel/task_delayacct"))
+		/* kernels older than 5.14 don't have this sysctl;
+		   delay accounting is enabled unless booted with
+		   "nodelayacct" */
+		return true;
+
+	char ch;
+	return f.Read(std::as_writable_bytes(std::span{&ch, 1})) == 1 &&
+		ch != '0';
+}
+
+/**
+ * Collects delay accounting counters via taskstats (option
+ * "taskstats").  If taskstats is unavailable, this does nothing.
+ */
+class DelayCollector {
+	/**
+	 * One client per scanner thread, so the threads don't have
+	 * to take turns on one socket.  Empty if taskstats is
+	 * unavailable.
+	 */
+	std::vector<TaskstatsClient> clients;
+
+	/**
+	 * Is kernel delay accounting enabled, i.e. are the "blkio"
+	 * and "swapin" delays meaningful?
+	 */
+	bool delayacct = false;
+
+public:
+	/**
+	 * @param n_clients the number of threads which will call
+	 * Collect() concurrently
+	 */
+	DelayCollector(const ProcessExporterConfig &config,
+		       std::size_t n_clients) noexcept {
+		if (!config.taskstats)
 			return;
 
-		const auto stat = WithSmallTextFile<1024>(FileAt{pid_fd, "stat"},
-							  ParseProcessStat);
+		try {
+			clients.reserve(n_clients);
+			clients.emplace_back();
+		} catch (...) {
+			fmt::print(stderr, "Taskstats unavailable, no delay metrics: ");
+			PrintException(std::current_exception());
+			return;
+		}
+
+		try {
+			while (clients.size() < n_clients)
+				clients.emplace_back();
+		} catch (...) {
+			/* probably out of file descriptors; the caller
+			   gets fewer clients (see GetClientCount()) */
+			PrintException(std::current_exception());
+		}
+
+		delayacct = IsDelayAccountingEnabled();
+		if (!delayacct)
+			fmt::print(stderr, "Delay accounting is disabled (sysctl kernel.task_delayacct), exporting only CPU delays\n");
+	}
 
-		ProcessInfo info;
-		info.comm = std::string{stat.comm};
-		info.exe = std::string{name};
-		info.cmdline = ReadTextFile<4096>(FileAt{pid_fd, "cmdline"});
-		std::replace(info.cmdline.begin(), info.cmdline.end(),
-			     '\0', ' ');
+	bool HasCpu() const noexcept {
+		return !clients.empty();
+	}
+
+	bool HasIo() const noexcept {
+		return delayacct;
+	}
+
+	/**
+	 * The number of threads which may call Collect()
+	 * concurrently.
+	 */
+	std::size_t GetClientCount() const noexcept {
+		return clients.size();
+	}
 
-		auto group_name = config.MakeName(info);
-		if (group_name.empty())
+	/**
+	 * @param thread the index of the calling thread; no two
+	 * threads may pass the same index at the same time
+	 */
+	void Collect(ProcessGroupData &group, unsigned pid,
+		     std::size_t thread) {
+		if (clients.empty())
 			return;
 
-		auto e = groups.emplace(std::move(group_name),
-					ProcessGroupData{});
-		auto &group = e.first->second;
-		++group.n_procs;
+		assert(thread < clients.size());
+
+		if (const auto delays = clients[thread].QueryTgid(pid))
+			group += *delays;
+	}
+};
+
+/**
+ * Read /proc/PID/stat.  Throws if the process does not exist
+ * (anymore).
+ *
+ * @param comm receives a copy of the "comm" field
+ */
+static ProcessStat
+ReadProcessStat(FileDescriptor pid_fd, std::string &comm)
+{
+	return WithSmallTextFile<1024>(FileAt{pid_fd, "stat"}, [&comm](std::string_view contents){
+		auto result = ParseProcessStat(contents);
+
+		/* copy comm while the buffer is still valid */
+		comm = result.comm;
+		result.comm = {};
+		return result;
+	});
+}
+
+/**
+ * Refresh those #ProcessSlowValues whose interval has elapsed.
+ * Errors (e.g. a process which has exited meanwhile) are ignored;
+ * the old values are kept then.
+ */
+static void
+UpdateSlowValues(const ProcessExporterConfig &config, ProcessSlowState &state,
+		 FileDescriptor pid_fd) noexcept
+{
+	if (!config.smaps_rollup_interval && !config.io_interval &&
+	    !config.fd_interval)
+		return;
+
+	const auto now = ProcessSlowState::Clock::now();
+
+	if (config.smaps_rollup_interval && now >= state.next_smaps_rollup) {
+		state.next_smaps_rollup = now + *config.smaps_rollup_interval;
+
+		if (UniqueFileDescriptor fd;
+		    fd.OpenReadOnly({pid_fd, "smaps_rollup"})) {
+			try {
+				state.values.pss = WithSmallTextFile<4096>(fd, ParseSmapsRollup);
+			} catch (...) {
+			}
+		}
+	}
+
+	if (config.io_interval && now >= state.next_io) {
+		state.next_io = now + *config.io_interval;
+
+		if (UniqueFileDescriptor fd; fd.OpenReadOnly({pid_fd, "io"})) {
+			try {
+				WithSmallTextFile<1024>(fd, [&state](std::string_view contents){
+					ParseProcessIo(state.values, contents);
+				});
+			} catch (...) {
+			}
+		}
+	}
+
+	if (config.fd_interval && now >= state.next_fds) {
+		state.next_fds = now + *config.fd_interval;
+
+		if (UniqueFileDescriptor fd;
+		    fd.Open({pid_fd, "fd"}, O_RDONLY|O_DIRECTORY))
+			state.values.open_fds = CountDirectoryEntries(fd);
+	}
+}
+
+/**
+ * Read /proc/PID/stat from an already open file with pread() at
+ * offset 0, so the file can be read again on the next scrape
+ * without reopening it.
+ *
+ * @param comm receives a copy of the "comm" field
+ * @return false on error (e.g. the process has exited)
+ */
+static bool
+PreadProcessStat(FileDescriptor fd, ProcessStat &stat, std::string &comm) noexcept
+{
+	char buffer[1024];
+	const ssize_t nbytes = pread(fd.Get(), buffer, sizeof(buffer), 0);
+	if (nbytes <= 0)
+		return false;
+
+	stat = ParseProcessStat({buffer, static_cast<std::size_t>(nbytes)});
+	comm = stat.comm;
+	stat.comm = {};
+	return true;
+}
+
+/**
+ * Obtain the /proc/PID directory of a process (from the cache if
+ * possible) and read its "stat".  On success, the start time of the
+ * cache entry is updated.
+ *
+ * @param buffer owns the new handles if they don't fit into the
+ * cache
+ * @return the directory (O_PATH) or an undefined descriptor if the
+ * process does not exist (anymore)
+ */
+static FileDescriptor
+OpenProcess(ProcessCache &cache, ProcessCache::Entry &entry,
+	    FileDescriptor proc_fd, unsigned pid,
+	    ProcessCache::Handles &buffer,
+	    ProcessStat &stat, std::string &comm) noexcept
+{
+	if (entry.handles.directory.IsDefined()) {
+		if (PreadProcessStat(entry.handles.stat, stat, comm) &&
+		    stat.starttime == entry.GetStartTime())
+			return entry.handles.directory;
+
+		/* the process has exited (and the pid may have been
+		   reused) */
+		cache.RemoveHandles(entry);
+	}
+
+	buffer.directory = OpenProcessDirectory(proc_fd, pid);
+	if (!buffer.directory.IsDefined() ||
+	    !buffer.stat.OpenReadOnly({buffer.directory, "stat"}) ||
+	    !PreadProcessStat(buffer.stat, stat, comm))
+		return FileDescriptor::Undefined();
+
+	entry.SetStartTime(stat.starttime);
+
+	if (cache.AddHandles(entry, std::move(buffer)))
+		return entry.handles.directory;
+
+	return buffer.directory;
+}
+
+/**
+ * State which is kept between /proc scans.
+ */
+struct ProcessScanState {
+	ProcessCache cache;
+	DelayCollector delays;
+
+	/**
+	 * The number of threads scanning /proc.  This starts with
+	 * the configured value and is reduced if not all threads
+	 * could be created, so the failure is not repeated on each
+	 * scrape.
+	 */
+	std::size_t threads;
+
+	explicit ProcessScanState(const ProcessExporterConfig &config) noexcept
+		:cache(config.max_cached_fds),
+		 delays(config, config.threads),
+		 threads(config.threads)
+	{
+		/* each thread needs its own taskstats client */
+		if (delays.HasCpu())
+			threads = std::min(threads, delays.GetClientCount());
+	}
+};
 
+/**
+ * Look up the group of one process and add its values to the group
+ * in the map.  Throws if the process has exited meanwhile.
+ */
+static void
+ScanProcess(const ProcessExporterConfig &config, ProcessScanState &state,
+	    ProcessGroupMap &groups, std::size_t thread,
+	    ProcessCache::Entry &entry,
+	    unsigned pid, FileDescriptor pid_fd,
+	    const ProcessStat &stat, const std::string &comm)
+{
+	const auto &group_name = entry.GetName(comm, [&]{
+		return ClassifyProcess(config, pid_fd, comm);
+	});
+
+	if (group_name.empty())
+		return;
+
+	auto e = groups.emplace(group_name, ProcessGroupData{});
+	auto &group = e.first->second;
+	++group.n_procs;
+
+	if (config.per_thread) {
 		ForEachProcessThread(pid_fd, [&](unsigned tid, FileDescriptor tid_fd){
 			++group.n_threads;
-			CollectProcess(group, tid, tid_fd);
+			CollectProcess(group, tid, tid_fd, config.schedstat);
 		});
-	});
+	} else {
+		/* the process's "stat" has the totals of all
+		   threads */
+		group += stat;
+		group.n_threads += stat.num_threads;
+
+		CollectThreadCounters(group, pid_fd, stat.num_threads,
+				      config.thread_context_switches,
+				      config.schedstat);
+	}
 
-	return groups;
+	state.delays.Collect(group, pid, thread);
+
+	UpdateSlowValues(config, entry.slow, pid_fd);
+	group += entry.slow.values;
+}
+
+/**
+ * Scan the processes in the given list.  Several threads may call
+ * this concurrently; they take batches from the list by
+ * incrementing the shared index, so a thread which got cheap
+ * processes takes more of them.
+ */
+static void
+ScanProcesses(const ProcessExporterConfig &config, ProcessScanState &state,
+	      ProcessGroupMap &groups, std::size_t thread,
+	      FileDescriptor proc_fd, std::span<const unsigned> pids,
+	      std::atomic_size_t &next) noexcept
+{
+	static constexpr std::size_t BATCH = 64;
+
+	while (true) {
+		const std::size_t begin = next.fetch_add(BATCH, std::memory_order_relaxed);
+		if (begin >= pids.size())
+			break;
+
+		for (const unsigned pid : pids.subspan(begin, std::min(BATCH, pids.size() - begin))) {
+			try {
+				auto &entry = state.cache.Get(pid);
+				ProcessCache::Handles buffer;
+				ProcessStat stat;
+				std::string comm;
+
+				const auto pid_fd = OpenProcess(state.cache, entry,
+								proc_fd, pid,
+								buffer, stat, comm);
+				if (pid_fd.IsDefined())
+					ScanProcess(config, state, groups, thread,
+						    entry, pid, pid_fd, stat, comm);
+			} catch (...) {
+				/* the process has exited meanwhile */
+			}
+		}
+	}
+}
+
+static ProcessGroupMap
+CollectProcessGroups(const ProcessExporterConfig &config,
+		     ProcessScanState &state, FileDescriptor proc_fd)
+{
+	/* read the pid list once, then let the threads share it */
+	const auto pids = ListProcesses(proc_fd);
+	std::atomic_size_t next{0};
+
+	/* each thread has its own map; they are merged at the
+	   end */
+	std::vector<ProcessGroupMap> maps(state.threads);
+
+	state.cache.BeginScan();
+
+	std::vector<std::thread> threads;
+	threads.reserve(maps.size() - 1);
+
+	try {
+		for (std::size_t i = 1; i < maps.size(); ++i)
+			threads.emplace_back([&, i]{
+				ScanProcesses(config, state, maps[i], i,
+					      proc_fd, pids, next);
+			});
+	} catch (...) {
+		/* probably limited by "TasksMax"; continue with
+		   the threads we have */
+		PrintException(std::current_exception());
+	}
+
+	ScanProcesses(config, state, maps.front(), 0,
+		      proc_fd, pids, next);
+
+	for (auto &i : threads)
+		i.join();
+
+	if (threads.size() + 1 < state.threads) {
+		state.threads = threads.size() + 1;
+		fmt::print(stderr, "Scanning /proc with {} thread(s) from now on\n",
+			   state.threads);
+	}
+
+	state.cache.EndScan();
+
+	auto &groups = maps.front();
+	for (std::size_t i = 1; i < maps.size(); ++i)
+		for (const auto &[name, data] : maps[i])
+			groups[name] += data;
+
+	return std::move(groups);
 }
 
 static void
-DumpProcessGroups(BufferedOutputStream &os, const ProcessGroupMap &groups)
+DumpProcessGroups(BufferedOutputStream &os,
+		  const ProcessExporterConfig &config,
+		  const ProcessGroupMap &groups,
+		  bool context_switches, const DelayCollector &delays)
 {
-	os.Write(R"(# HELP namedprocess_namegroup_context_switches_total Context switches
+	if (context_switches) {
+		os.Write(R"(# HELP namedprocess_namegroup_context_switches_total Context switches
 # TYPE namedprocess_namegroup_context_switches_total counter
 )");
 
-	for (const auto &i : groups)
-		os.Fmt("namedprocess_namegroup_context_switches_total{{groupname={:?},ctxswitchtype=\"nonvoluntary\"}} {}\n"
-		       "namedprocess_namegroup_context_switches_total{{groupname={:?},ctxswitchtype=\"voluntary\"}} {}\n",
-		       i.first, i.second.nonvoluntary_ctxt_switches,
-		       i.first, i.second.voluntary_ctxt_switches);
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_context_switches_total{{groupname={:?},ctxswitchtype=\"nonvoluntary\"}} {}\n"
+			       "namedprocess_namegroup_context_switches_total{{groupname={:?},ctxswitchtype=\"voluntary\"}} {}\n",
+			       i.first, i.second.nonvoluntary_ctxt_switches,
+			       i.first, i.second.voluntary_ctxt_switches);
+	}
 
 	os.Write(R"(# HELP namedprocess_namegroup_cpu_seconds_total Cpu user usage in seconds
 # TYPE namedprocess_namegroup_cpu_seconds_total counter
@@ -242,6 +849,49 @@ DumpProcessGroups(BufferedOutputStream &os, const ProcessGroupMap &groups)
 		       i.first, i.second.stime * clock_ticks_to_s,
 		       i.first, i.second.utime * clock_ticks_to_s);
 
+	if (delays.HasCpu()) {
+		os.Write(R"(# HELP namedprocess_namegroup_delay_seconds_total Time spent waiting for a CPU, synchronous block I/O or swapin
+# TYPE namedprocess_namegroup_delay_seconds_total counter
+)");
+
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_delay_seconds_total{{groupname={:?},type=\"cpu\"}} {:e}\n",
+			       i.first, i.second.cpu_delay / 1e9);
+
+		if (delays.HasIo())
+			for (const auto &i : groups)
+				os.Fmt("namedprocess_namegroup_delay_seconds_total{{groupname={:?},type=\"blkio\"}} {:e}\n"
+				       "namedprocess_namegroup_delay_seconds_total{{groupname={:?},type=\"swapin\"}} {:e}\n",
+				       i.first, i.second.blkio_delay / 1e9,
+				       i.first, i.second.swapin_delay / 1e9);
+	}
+
+	if (config.schedstat) {
+		os.Write(R"(# HELP namedprocess_namegroup_runqueue_wait_seconds_total Time spent waiting on a run queue
+# TYPE namedprocess_namegroup_runqueue_wait_seconds_total counter
+)");
+
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_runqueue_wait_seconds_total{{groupname={:?}}} {:e}\n",
+			       i.first, i.second.sched_wait / 1e9);
+
+		os.Write(R"(# HELP namedprocess_namegroup_sched_runtime_seconds_total Time spent on a CPU according to the scheduler
+# TYPE namedprocess_namegroup_sched_runtime_seconds_total counter
+)");
+
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_sched_runtime_seconds_total{{groupname={:?}}} {:e}\n",
+			       i.first, i.second.sched_runtime / 1e9);
+
+		os.Write(R"(# HELP namedprocess_namegroup_sched_timeslices_total Number of timeslices run on a CPU
+# TYPE namedprocess_namegroup_sched_timeslices_total counter
+)");
+
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_sched_timeslices_total{{groupname={:?}}} {}\n",
+			       i.first, i.second.sched_timeslices);
+	}
+
 	os.Write(R"(# HELP namedprocess_namegroup_memory_bytes number of bytes of memory in use
 # TYPE namedprocess_namegroup_memory_bytes gauge
 )");
@@ -254,6 +904,39 @@ DumpProcessGroups(BufferedOutputStream &os, const ProcessGroupMap &groups)
 		       i.first, i.second.vsize,
 		       i.first, i.second.rss * page_size);
 
+	if (config.smaps_rollup_interval)
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_memory_bytes{{groupname={:?},memtype=\"proportionalResident\"}} {}\n",
+			       i.first, i.second.pss);
+
+	if (config.io_interval) {
+		os.Write(R"(# HELP namedprocess_namegroup_read_bytes_total number of bytes read from storage
+# TYPE namedprocess_namegroup_read_bytes_total counter
+)");
+
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_read_bytes_total{{groupname={:?}}} {}\n",
+			       i.first, i.second.read_bytes);
+
+		os.Write(R"(# HELP namedprocess_namegroup_write_bytes_total number of bytes written to storage
+# TYPE namedprocess_namegroup_write_bytes_total counter
+)");
+
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_write_bytes_total{{groupname={:?}}} {}\n",
+			       i.first, i.second.write_bytes);
+	}
+
+	if (config.fd_interval) {
+		os.Write(R"(# HELP namedprocess_namegroup_open_filedesc number of open file descriptors
+# TYPE namedprocess_namegroup_open_filedesc gauge
+)");
+
+		for (const auto &i : groups)
+			os.Fmt("namedprocess_namegroup_open_filedesc{{groupname={:?}}} {}\n",
+			       i.first, i.second.open_fds);
+	}
+
 	os.Write(R"(# HELP namedprocess_namegroup_minor_page_faults_total Minor page faults
 # TYPE namedprocess_namegroup_minor_page_faults_total counter
 )");
@@ -280,18 +963,627 @@ DumpProcessGroups(BufferedOutputStream &os, const ProcessGroupMap &groups)
 }
 
 static void
-ExportProc(const ProcessExporterConfig &config, BufferedOutputStream &os,
-	   FileDescriptor proc_fd)
+ExportProc(const ProcessExporterConfig &config, ProcessScanState &state,
+	   BufferedOutputStream &os, FileDescriptor proc_fd)
 {
-	DumpProcessGroups(os, CollectProcessGroups(config, proc_fd));
+	/* without per-thread "status", the context switch
+	   counters are unknown */
+	const bool context_switches = config.per_thread ||
+		config.thread_context_switches;
+
+	DumpProcessGroups(os, config,
+			  CollectProcessGroups(config, state, proc_fd),
+			  context_switches, state.delays);
 }
 
 static void
-ExportProc(const ProcessExporterConfig &config, BufferedOutputStream &os)
+ExportProc(const ProcessExporterConfig &config, ProcessScanState &state,
+	   BufferedOutputStream &os)
 {
-	ExportProc(config, os, OpenDirectory("/proc"));
+	ExportProc(config, state, os, OpenDirectory("/proc"));
 }
 
+/**
+ * Add the counters which a process has accumulated since the given
+ * snapshot.  Counters which have decreased (see below) add nothing.
+ * Gauges are not touched.
+ */
+static void
+AddCounters(ProcessGroupData &dest, const ProcessGroupData &now,
+	    const ProcessGroupData &since) noexcept
+{
+	/* the sums of the threads' context switch counters and
+	   schedstat values drop when a thread exits; don't let that
+	   wrap around */
+	constexpr auto Delta = [](uint_least64_t a, uint_least64_t b){
+		return a > b ? a - b : 0;
+	};
+
+	dest.voluntary_ctxt_switches += Delta(now.voluntary_ctxt_switches,
+					      since.voluntary_ctxt_switches);
+	dest.nonvoluntary_ctxt_switches += Delta(now.nonvoluntary_ctxt_switches,
+						 since.nonvoluntary_ctxt_switches);
+	dest.minflt += Delta(now.minflt, since.minflt);
+	dest.majflt += Delta(now.majflt, since.majflt);
+	dest.utime += Delta(now.utime, since.utime);
+	dest.stime += Delta(now.stime, since.stime);
+	dest.cpu_delay += Delta(now.cpu_delay, since.cpu_delay);
+	dest.blkio_delay += Delta(now.blkio_delay, since.blkio_delay);
+	dest.swapin_delay += Delta(now.swapin_delay, since.swapin_delay);
+	dest.read_bytes += Delta(now.read_bytes, since.read_bytes);
+	dest.write_bytes += Delta(now.write_bytes, since.write_bytes);
+	dest.sched_runtime += Delta(now.sched_runtime, since.sched_runtime);
+	dest.sched_wait += Delta(now.sched_wait, since.sched_wait);
+	dest.sched_timeslices += Delta(now.sched_timeslices, since.sched_timeslices);
+}
+
+static void
+AddCounters(ProcessGroupData &dest, const ProcessGroupData &src) noexcept
+{
+	AddCounters(dest, src, ProcessGroupData{});
+}
+
+/**
+ * The process table of the "proc_connector" mode: all processes
+ * which belong to a group, maintained from process connector events
+ * instead of scanning /proc for each scrape.  The counters of
+ * exited processes are retained, and the counters of each process
+ * are accumulated from its increases between reads, therefore group
+ * counters are monotonic and include processes which lived shorter
+ * than the scrape interval.
+ */
+class ProcessTable {
+	const ProcessExporterConfig &config;
+
+	const UniqueFileDescriptor proc_fd = OpenDirectory("/proc");
+
+	struct Process {
+		/**
+		 * Used to detect PID reuse; 0 if not yet known.
+		 */
+		uint_least64_t starttime;
+
+		std::string group;
+
+		/**
+		 * The counters accumulated since this process joined
+		 * its group (at fork, at execve() or since it was
+		 * created).  They are the sum of the increases
+		 * between two reads, so they never decrease, even if
+		 * a per-thread sum (context switches, schedstat)
+		 * drops because a thread has exited.
+		 */
+		ProcessGroupData counters{};
+
+		/**
+		 * The most recently read counters and gauges.
+		 */
+		ProcessGroupData last{};
+
+		/**
+		 * Add the increases since the previous read to
+		 * #counters and replace #last.
+		 */
+		void Update(const ProcessGroupData &now) noexcept {
+			AddCounters(counters, now, last);
+			last = now;
+		}
+
+		ProcessSlowState slow{};
+
+		/**
+		 * The sum of the final statistics of all threads
+		 * which have exited (see OnTaskExit()).
+		 */
+		ProcessGroupData exited_threads{};
+
+		unsigned n_exited_threads = 0;
+
+		/**
+		 * Have we received the final statistics of the main
+		 * thread?
+		 */
+		bool leader_exited = false;
+
+		/**
+		 * Set by OnExit(); the process will be retired by the
+		 * next Collect().  This gives the taskstats messages
+		 * of its threads a chance to arrive.
+		 */
+		bool exited = false;
+
+		/**
+		 * Apply the statistics of #exited_threads which are
+		 * higher than #last.  This accounts for what the
+		 * process did after the last read, even if it was
+		 * reaped before it could be read again.
+		 */
+		void ApplyExitedThreads() noexcept;
+	};
+
+	std::unordered_map<unsigned, Process> processes;
+
+	/**
+	 * The counters accumulated by processes which have exited or
+	 * have left their group by execve().
+	 */
+	ProcessGroupMap retired;
+
+	/**
+	 * Used by Rescan() to avoid classifying all processes again
+	 * (the process handles are not cached here).
+	 */
+	ProcessCache cache{0};
+
+	DelayCollector delays{config, 1};
+
+	/**
+	 * Must /proc be scanned before the next scrape because events
+	 * may have been lost?
+	 */
+	bool rescan = true;
+
+	/**
+	 * Set if the process connector has failed; from then on,
+	 * /proc is scanned for each scrape.
+	 */
+	bool failed = false;
+
+public:
+	explicit ProcessTable(const ProcessExporterConfig &_config)
+		:config(_config) {}
+
+	bool Contains(unsigned pid) const noexcept {
+		return processes.contains(pid);
+	}
+
+	void OnFork(unsigned parent_pid, unsigned child_pid) noexcept;
+	void OnExec(unsigned pid) noexcept;
+	void OnExit(unsigned pid) noexcept;
+
+	/**
+	 * A thread has exited; add its final statistics to its
+	 * process (if that one belongs to a group).
+	 */
+	void OnTaskExit(const TaskstatsExit &e) noexcept;
+
+	void Invalidate() noexcept {
+		rescan = true;
+	}
+
+	void SetFailed() noexcept {
+		failed = rescan = true;
+	}
+
+	ProcessGroupMap Collect();
+
+	const DelayCollector &GetDelays() const noexcept {
+		return delays;
+	}
+
+private:
+	UniqueFileDescriptor OpenProcess(unsigned pid) const noexcept {
+		return OpenProcessDirectory(proc_fd, pid);
+	}
+
+	ProcessGroupData ReadSnapshot(unsigned pid, FileDescriptor pid_fd,
+				      const ProcessStat &stat,
+				      ProcessSlowState &slow);
+
+	/**
+	 * Read the process and call Process::Update().
+	 *
+	 * @return false if the process does not exist anymore
+	 */
+	bool Read(unsigned pid, Process &process) noexcept;
+
+	/**
+	 * Move the counters of a process which has exited or has left
+	 * its group to #retired.
+	 */
+	void Retire(Process &process) {
+		process.ApplyExitedThreads();
+		AddCounters(retired[process.group], process.counters);
+	}
+
+	/**
+	 * Scan /proc to rebuild the table.  Processes which are
+	 * already known (same PID, start time and group) keep their
+	 * counters.
+	 */
+	void Rescan();
+};
+
+void
+ProcessTable::Process::ApplyExitedThreads() noexcept
+{
+	if (n_exited_threads == 0)
+		return;
+
+	const auto &e = exited_threads;
+	auto now = last;
+
+	/* these counters of the process include its exited threads,
+	   so the sum of the exited threads can only be higher if
+	   the process has done something since it was last read */
+	now.minflt = std::max(now.minflt, e.minflt);
+	now.majflt = std::max(now.majflt, e.majflt);
+	now.utime = std::max(now.utime, e.utime);
+	now.stime = std::max(now.stime, e.stime);
+	now.cpu_delay = std::max(now.cpu_delay, e.cpu_delay);
+	now.blkio_delay = std::max(now.blkio_delay, e.blkio_delay);
+	now.swapin_delay = std::max(now.swapin_delay, e.swapin_delay);
+	now.read_bytes = std::max(now.read_bytes, e.read_bytes);
+	now.write_bytes = std::max(now.write_bytes, e.write_bytes);
+
+	/* these are sums over the live threads; they are comparable
+	   only if the main thread is the only one we have ever
+	   seen (e.g. a short-lived worker process) */
+	if (leader_exited && n_exited_threads == 1 && last.n_threads <= 1) {
+		now.voluntary_ctxt_switches = std::max(now.voluntary_ctxt_switches,
+						       e.voluntary_ctxt_switches);
+		now.nonvoluntary_ctxt_switches = std::max(now.nonvoluntary_ctxt_switches,
+							  e.nonvoluntary_ctxt_switches);
+		now.sched_runtime = std::max(now.sched_runtime, e.sched_runtime);
+		now.sched_wait = std::max(now.sched_wait, e.sched_wait);
+		now.sched_timeslices = std::max(now.sched_timeslices, e.sched_timeslices);
+	}
+
+	Update(now);
+}
+
+ProcessGroupData
+ProcessTable::ReadSnapshot(unsigned pid, FileDescriptor pid_fd,
+			   const ProcessStat &stat, ProcessSlowState &slow)
+{
+	ProcessGroupData data;
+	data += stat;
+	data.n_threads = stat.num_threads;
+
+	CollectThreadCounters(data, pid_fd, stat.num_threads,
+			      config.thread_context_switches,
+			      config.schedstat);
+
+	delays.Collect(data, pid, 0);
+
+	UpdateSlowValues(config, slow, pid_fd);
+	data += slow.values;
+
+	return data;
+}
+
+bool
+ProcessTable::Read(unsigned pid, Process &process) noexcept
+try {
+	const auto pid_fd = OpenProcess(pid);
+	if (!pid_fd.IsDefined())
+		return false;
+
+	std::string comm;
+	const auto stat = ReadProcessStat(pid_fd, comm);
+
+	if (process.starttime == 0) {
+		process.starttime = stat.starttime;
+	} else if (stat.starttime != process.starttime) {
+		/* the PID was reused, which means we have missed
+		   events */
+		rescan = true;
+		return false;
+	}
+
+	process.Update(ReadSnapshot(pid, pid_fd, stat, process.slow));
+	return true;
+} catch (...) {
+	/* the process has exited meanwhile */
+	return false;
+}
+
+void
+ProcessTable::OnFork(unsigned parent_pid, unsigned child_pid) noexcept
+try {
+	const auto parent = processes.find(parent_pid);
+	if (parent == processes.end())
+		/* the child runs the same program as its parent, so
+		   it does not belong to any group either */
+		return;
+
+	/* the child's counters start at zero; its start time will
+	   be learned by the next Read() */
+	Process child{.starttime = 0, .group = parent->second.group};
+
+	if (auto [i, inserted] = processes.try_emplace(child_pid, std::move(child));
+	    !inserted) {
+		/* we have missed the exit of a process with the same
+		   PID */
+		Retire(i->second);
+		i->second = std::move(child);
+	}
+} catch (...) {
+	PrintException(std::current_exception());
+}
+
+void
+ProcessTable::OnExec(unsigned pid) noexcept
+try {
+	auto i = processes.find(pid);
+
+	const auto pid_fd = OpenProcess(pid);
+	if (!pid_fd.IsDefined()) {
+		/* exited already; the exit event will follow */
+		return;
+	}
+
+	std::string comm;
+	const auto stat = ReadProcessStat(pid_fd, comm);
+	auto group = ClassifyProcess(config, pid_fd, comm);
+
+	if (i != processes.end() && i->second.group == group)
+		/* still the same group: nothing changes */
+		return;
+
+	if (i == processes.end() && group.empty())
+		return;
+
+	/* the counters at the time of the execve(); everything
+	   before belongs to the old group, everything after to the
+	   new one */
+	ProcessSlowState new_slow;
+	auto &slow = i != processes.end() ? i->second.slow : new_slow;
+	const auto now = ReadSnapshot(pid, pid_fd, stat, slow);
+
+	if (i != processes.end()) {
+		i->second.Update(now);
+		Retire(i->second);
+
+		if (group.empty()) {
+			processes.erase(i);
+			return;
+		}
+
+		i->second.group = std::move(group);
+
+		/* the threads killed by execve() are included in
+		   "now" */
+		i->second.exited_threads = {};
+		i->second.n_exited_threads = 0;
+	} else {
+		i = processes.try_emplace(pid, Process{
+				.starttime = stat.starttime,
+				.group = std::move(group),
+				.slow = new_slow,
+			}).first;
+	}
+
+	i->second.starttime = stat.starttime;
+	i->second.counters = {};
+	i->second.last = now;
+} catch (...) {
+	/* the process has exited meanwhile */
+}
+
+void
+ProcessTable::OnExit(unsigned pid) noexcept
+try {
+	const auto i = processes.find(pid);
+	if (i == processes.end())
+		return;
+
+	/* if the process is still a zombie, we can read its final
+	   counters; but its parent may have reaped it already, and
+	   then only the taskstats messages of its threads (see
+	   OnTaskExit()) tell what it did since the last scrape;
+	   without them, that is lost */
+	Read(pid, i->second);
+
+	/* retire it later, because the taskstats messages are
+	   received on another socket and may not have been handled
+	   yet */
+	i->second.exited = true;
+} catch (...) {
+	PrintException(std::current_exception());
+}
+
+void
+ProcessTable::OnTaskExit(const TaskstatsExit &e) noexcept
+{
+	/* old kernels don't report the thread group; then only
+	   the main thread can be assigned */
+	const unsigned tgid = e.tgid != 0 ? e.tgid : e.pid;
+
+	const auto i = processes.find(tgid);
+	if (i == processes.end())
+		return;
+
+	auto &process = i->second;
+	process.exited_threads += e;
+	++process.n_exited_threads;
+
+	if (e.pid == tgid)
+		process.leader_exited = true;
+}
+
+void
+ProcessTable::Rescan()
+{
+	rescan = failed;
+
+	auto old = std::move(processes);
+	processes.clear();
+
+	cache.BeginScan();
+
+	ForEachProcess(proc_fd, [&](unsigned pid, FileDescriptor pid_fd){
+		try {
+			std::string comm;
+			const auto stat = ReadProcessStat(pid_fd, comm);
+
+			auto &entry = cache.Get(pid);
+			entry.SetStartTime(stat.starttime);
+
+			const auto &group = entry.GetName(comm, [&]{
+				return ClassifyProcess(config, pid_fd, comm);
+			});
+
+			if (group.empty())
+				return;
+
+			if (auto i = old.find(pid);
+			    i != old.end() && i->second.group == group &&
+			    (i->second.starttime == 0 ||
+			     i->second.starttime == stat.starttime)) {
+				/* still the same process */
+				processes.insert(old.extract(i));
+				return;
+			}
+
+			/* a process we didn't know: count everything
+			   since it was created */
+			processes.try_emplace(pid, Process{.starttime = stat.starttime, .group = group});
+		} catch (...) {
+			/* the process has exited meanwhile */
+		}
+	});
+
+	cache.EndScan();
+
+	/* these have disappeared without an event */
+	for (auto &[pid, process] : old)
+		Retire(process);
+}
+
+ProcessGroupMap
+ProcessTable::Collect()
+{
+	if (rescan)
+		Rescan();
+
+	ProcessGroupMap groups;
+
+	for (auto i = processes.begin(); i != processes.end();) {
+		auto &process = i->second;
+		if (process.exited || !Read(i->first, process)) {
+			Retire(process);
+			i = processes.erase(i);
+			continue;
+		}
+
+		auto &group = groups[process.group];
+		++group.n_procs;
+		group.n_threads += process.last.n_threads;
+		group.vsize += process.last.vsize;
+		group.rss += process.last.rss;
+		group.pss += process.last.pss;
+		group.open_fds += process.last.open_fds;
+		AddCounters(group, process.counters);
+
+		++i;
+	}
+
+	/* after the loop, which may have retired more processes */
+	for (const auto &[name, data] : retired)
+		groups[name] += data;
+
+	return groups;
+}
+
+/**
+ * The "proc_connector" mode: the process table is maintained by
+ * events from the kernel while waiting for scrapes.
+ */
+class ProcessExporter final
+	: public PrometheusExporterHandler, ProcessConnectorHandler,
+	  TaskstatsExitHandler
+{
+	const ProcessExporterConfig &config;
+
+	ProcessTable table;
+
+	ProcessConnector connector;
+
+	/**
+	 * Provides the final counters of processes which were
+	 * reaped before we could read them; unavailable without
+	 * CONFIG_TASKSTATS.
+	 */
+	std::optional<TaskstatsExitListener> exits;
+
+public:
+	ProcessExporter(EventLoop &event_loop,
+			const ProcessExporterConfig &_config)
+		:config(_config), table(config),
+		 connector(event_loop, *this)
+	{
+		try {
+			exits.emplace(event_loop,
+				      static_cast<TaskstatsExitHandler &>(*this));
+		} catch (...) {
+			fmt::print(stderr, "Taskstats unavailable, the counters of processes which are reaped quickly may be incomplete: ");
+			PrintException(std::current_exception());
+		}
+	}
+
+	// virtual methods from class PrometheusExporterHandler
+	std::string OnPrometheusExporterRequest() override {
+		connector.Flush();
+		FlushExits();
+
+		StringOutputStream sos;
+		BufferedOutputStream bos(sos);
+		DumpProcessGroups(bos, config, table.Collect(),
+				  config.thread_context_switches,
+				  table.GetDelays());
+		bos.Flush();
+		return sos.GetValue();
+	}
+
+	void OnPrometheusExporterError(std::exception_ptr error) noexcept override {
+		PrintException(std::move(error));
+	}
+
+private:
+	/**
+	 * Handle all pending taskstats messages.  This is called
+	 * before adding processes to the table, so messages of an
+	 * earlier process with the same PID cannot be mistaken for
+	 * the new one's.
+	 */
+	void FlushExits() noexcept {
+		if (exits)
+			exits->Flush();
+	}
+
+	// virtual methods from class ProcessConnectorHandler
+	void OnProcessFork(unsigned parent_pid, unsigned child_pid) noexcept override {
+		if (table.Contains(parent_pid))
+			FlushExits();
+
+		table.OnFork(parent_pid, child_pid);
+	}
+
+	void OnProcessExec(unsigned pid) noexcept override {
+		FlushExits();
+		table.OnExec(pid);
+	}
+
+	void OnProcessExit(unsigned pid) noexcept override {
+		table.OnExit(pid);
+	}
+
+	void OnProcessConnectorOverflow() noexcept override {
+		table.Invalidate();
+	}
+
+	void OnProcessConnectorError(std::exception_ptr error) noexcept override {
+		PrintException(std::move(error));
+		table.SetFailed();
+	}
+
+	// virtual methods from class TaskstatsExitHandler
+	void OnTaskExit(const TaskstatsExit &e) noexcept override {
+		table.OnTaskExit(e);
+	}
+};
+
 int
 main(int argc, char **argv) noexcept
 try {
@@ -306,8 +1598,17 @@ try {
 
 	const auto config = LoadProcessExporterConfig(config_file);
 
+	if (config.proc_connector && sd_listen_fds(false) > 0) {
+		EventLoop event_loop;
+		ProcessExporter process_exporter{event_loop, config};
+		EFrontend frontend{event_loop, process_exporter};
+		return frontend.Run(event_loop);
+	}
+
+	ProcessScanState state{config};
+
 	return RunExporter([&](BufferedOutputStream &os){
-		ExportProc(config, os);
+		ExportProc(config, state, os);
 	});
 } catch (...) {
 	PrintException(std::current_exception());
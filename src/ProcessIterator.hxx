@@ -10,9 +10,52 @@
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/PrintException.hxx"
 
+#include <charconv>
 #include <concepts>
 #include <cstdlib>
 #include <exception>
+#include <vector>
+
+#include <fcntl.h>
+
+/**
+ * Read the ids of all processes from /proc.
+ */
+inline std::vector<unsigned>
+ListProcesses(FileDescriptor proc_fd)
+{
+	std::vector<unsigned> pids;
+
+	DirectoryReader r(OpenDirectory({proc_fd, "."}));
+	while (auto name = r.Read()) {
+		char *endptr;
+		auto pid = std::strtoul(name, &endptr, 10);
+		if (endptr == name || *endptr != 0 || pid <= 0)
+			/* not a positive number */
+			continue;
+
+		pids.push_back(pid);
+	}
+
+	return pids;
+}
+
+/**
+ * Open the /proc/PID directory with O_PATH.
+ *
+ * @return an undefined descriptor if the process does not exist
+ * (anymore)
+ */
+inline UniqueFileDescriptor
+OpenProcessDirectory(FileDescriptor proc_fd, unsigned pid) noexcept
+{
+	char name[16];
+	*std::to_chars(name, name + sizeof(name) - 1, pid).ptr = 0;
+
+	UniqueFileDescriptor fd;
+	(void)fd.Open({proc_fd, name}, O_PATH|O_DIRECTORY);
+	return fd;
+}
 
 void
 ForEachProcess(FileDescriptor proc_fd,
@@ -62,6 +105,28 @@ ForEachProcessThread(FileDescriptor pid_fd,
 	}
 }
 
+/**
+ * Like ForEachProcessThread(), but don't open the thread
+ * directories; instead, pass the "task" directory and the thread id
+ * string to the function, which may then open files relative to it
+ * (e.g. "TID/status").  This saves one open() per thread.
+ */
+void
+ForEachProcessThreadName(FileDescriptor pid_fd,
+			 std::invocable<FileDescriptor, const char *> auto f)
+{
+	DirectoryReader r(OpenDirectory({pid_fd, "task"}));
+	while (auto name = r.Read()) {
+		char *endptr;
+		auto tid = std::strtoul(name, &endptr, 10);
+		if (endptr == name || *endptr != 0 || tid <= 0)
+			/* not a positive number */
+			continue;
+
+		f(r.GetFileDescriptor(), name);
+	}
+}
+
 void
 ForEachThread(FileDescriptor proc_fd,
 	      std::invocable<unsigned, FileDescriptor> auto f)
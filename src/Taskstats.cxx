@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Taskstats.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef> // for offsetof()
+#include <cstring>
+#include <span>
+#include <stdexcept>
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * Invoke the function for each netlink attribute in the buffer.
+ */
+static void
+ForEachAttribute(std::span<const std::byte> s, auto &&f)
+{
+	while (s.size() >= NLA_HDRLEN) {
+		struct nlattr nla;
+		std::memcpy(&nla, s.data(), sizeof(nla));
+		if (nla.nla_len < NLA_HDRLEN || nla.nla_len > s.size())
+			break;
+
+		f(nla.nla_type & NLA_TYPE_MASK,
+		  s.subspan(NLA_HDRLEN, nla.nla_len - NLA_HDRLEN));
+
+		s = s.subspan(std::min<std::size_t>(NLA_ALIGN(nla.nla_len),
+						    s.size()));
+	}
+}
+
+TaskstatsClient::TaskstatsClient()
+{
+	const int s = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC,
+			     NETLINK_GENERIC);
+	if (s < 0)
+		throw MakeErrno("Failed to create netlink socket");
+
+	fd = UniqueFileDescriptor{AdoptTag{}, s};
+
+	/* look up the family id of "TASKSTATS" */
+
+	static constexpr char name[] = TASKSTATS_GENL_NAME;
+	Send(GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+	     CTRL_ATTR_FAMILY_NAME, name, sizeof(name));
+
+	alignas(struct nlmsghdr) std::byte buffer[4096];
+	const std::size_t size = Receive(buffer, sizeof(buffer));
+
+	family_id = 0;
+	ForEachAttribute(std::span{buffer, size}, [this](unsigned type, std::span<const std::byte> payload){
+		if (type == CTRL_ATTR_FAMILY_ID && payload.size() >= sizeof(uint16_t)) {
+			uint16_t id;
+			std::memcpy(&id, payload.data(), sizeof(id));
+			family_id = id;
+		}
+	});
+
+	if (family_id == 0)
+		throw std::runtime_error("Kernel does not support taskstats");
+
+	/* probe once, so missing privileges are reported now and
+	   not on every scrape */
+	QueryTgid(getpid());
+}
+
+void
+TaskstatsClient::Send(uint_least16_t type, uint_least8_t cmd,
+		      uint_least16_t attr_type,
+		      const void *attr, std::size_t attr_size,
+		      uint_least16_t flags)
+{
+	alignas(struct nlmsghdr) std::byte buffer[NLMSG_SPACE(GENL_HDRLEN + NLA_HDRLEN + 256)]{};
+	if (attr_size > 256)
+		throw std::invalid_argument("Attribute too large");
+
+	auto *nlh = reinterpret_cast<struct nlmsghdr *>(buffer);
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN + NLA_ALIGN(attr_size));
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST|flags;
+	nlh->nlmsg_seq = ++seq;
+
+	auto *genl = reinterpret_cast<struct genlmsghdr *>(NLMSG_DATA(nlh));
+	genl->cmd = cmd;
+	genl->version = 1;
+
+	auto *nla = reinterpret_cast<struct nlattr *>(reinterpret_cast<std::byte *>(genl) + GENL_HDRLEN);
+	nla->nla_type = attr_type;
+	nla->nla_len = NLA_HDRLEN + attr_size;
+	std::memcpy(reinterpret_cast<std::byte *>(nla) + NLA_HDRLEN,
+		    attr, attr_size);
+
+	if (send(fd.Get(), buffer, nlh->nlmsg_len, 0) < 0)
+		throw MakeErrno("Failed to send netlink request");
+}
+
+std::size_t
+TaskstatsClient::Receive(std::byte *buffer, std::size_t size)
+{
+	while (true) {
+		const ssize_t nbytes = recv(fd.Get(), buffer, size, 0);
+		if (nbytes < 0) {
+			if (errno == EINTR)
+				continue;
+
+			throw MakeErrno("Failed to receive netlink response");
+		}
+
+		int length = nbytes;
+		for (auto *nlh = reinterpret_cast<struct nlmsghdr *>(buffer);
+		     NLMSG_OK(nlh, length); nlh = NLMSG_NEXT(nlh, length)) {
+			if (nlh->nlmsg_seq != seq)
+				/* a stale response to an earlier
+				   request */
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				const auto &e = *reinterpret_cast<const struct nlmsgerr *>(NLMSG_DATA(nlh));
+				if (e.error == 0 || e.error == -ESRCH)
+					return 0;
+
+				throw MakeErrno(-e.error, "Netlink request failed");
+			}
+
+			const std::size_t payload_size = NLMSG_PAYLOAD(nlh, GENL_HDRLEN);
+			std::memmove(buffer,
+				     reinterpret_cast<const std::byte *>(NLMSG_DATA(nlh)) + GENL_HDRLEN,
+				     payload_size);
+			return payload_size;
+		}
+	}
+}
+
+std::optional<TaskstatsDelays>
+TaskstatsClient::QueryTgid(unsigned tgid)
+{
+	const uint32_t value = tgid;
+	Send(family_id, TASKSTATS_CMD_GET,
+	     TASKSTATS_CMD_ATTR_TGID, &value, sizeof(value));
+
+	alignas(struct nlmsghdr) std::byte buffer[4096];
+	const std::size_t size = Receive(buffer, sizeof(buffer));
+	if (size == 0)
+		return std::nullopt;
+
+	std::optional<TaskstatsDelays> result;
+
+	ForEachAttribute(std::span{buffer, size}, [&result](unsigned type, std::span<const std::byte> aggr){
+		if (type != TASKSTATS_TYPE_AGGR_TGID)
+			return;
+
+		ForEachAttribute(aggr, [&result](unsigned nested_type, std::span<const std::byte> payload){
+			if (nested_type != TASKSTATS_TYPE_STATS)
+				return;
+
+			/* the struct grows with each version; older
+			   kernels send less, newer ones more */
+			struct taskstats stats{};
+			std::memcpy(&stats, payload.data(),
+				    std::min(payload.size(), sizeof(stats)));
+
+			result.emplace();
+			result->cpu = stats.cpu_delay_total;
+			result->blkio = stats.blkio_delay_total;
+			result->swapin = stats.swapin_delay_total;
+		});
+	});
+
+	return result;
+}
+
+void
+TaskstatsClient::SetExitListener(const char *cpumask, bool enable)
+{
+	const std::size_t length = std::strlen(cpumask) + 1;
+
+	if (!enable) {
+		/* no acknowledgement: it would be queued behind
+		   exit messages */
+		Send(family_id, TASKSTATS_CMD_GET,
+		     TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK, cpumask, length);
+		return;
+	}
+
+	Send(family_id, TASKSTATS_CMD_GET,
+	     TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpumask, length,
+	     NLM_F_ACK);
+
+	alignas(struct nlmsghdr) std::byte buffer[4096];
+	Receive(buffer, sizeof(buffer));
+}
+
+std::optional<TaskstatsExit>
+ParseTaskstatsExit(std::span<const std::byte> attributes) noexcept
+{
+	std::optional<TaskstatsExit> result;
+
+	ForEachAttribute(attributes, [&result](unsigned type, std::span<const std::byte> aggr){
+		if (type != TASKSTATS_TYPE_AGGR_PID)
+			return;
+
+		ForEachAttribute(aggr, [&result](unsigned nested_type, std::span<const std::byte> payload){
+			if (nested_type != TASKSTATS_TYPE_STATS)
+				return;
+
+			struct taskstats stats{};
+			std::memcpy(&stats, payload.data(),
+				    std::min(payload.size(), sizeof(stats)));
+
+			auto &e = result.emplace();
+			e.pid = stats.ac_pid;
+			e.tgid = stats.version >= 12 &&
+				payload.size() >= offsetof(struct taskstats, ac_tgid) + sizeof(stats.ac_tgid)
+				? stats.ac_tgid
+				: 0;
+			e.utime = stats.ac_utime;
+			e.stime = stats.ac_stime;
+			e.minflt = stats.ac_minflt;
+			e.majflt = stats.ac_majflt;
+			e.voluntary_ctxt_switches = stats.nvcsw;
+			e.nonvoluntary_ctxt_switches = stats.nivcsw;
+			e.read_bytes = stats.read_bytes;
+			e.write_bytes = stats.write_bytes;
+			e.run_real_total = stats.cpu_run_real_total;
+			e.cpu_count = stats.cpu_count;
+			e.delays.cpu = stats.cpu_delay_total;
+			e.delays.blkio = stats.blkio_delay_total;
+			e.delays.swapin = stats.swapin_delay_total;
+		});
+	});
+
+	return result;
+}
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+/**
+ * Delay accounting counters of a thread group (including its exited
+ * threads) in nanoseconds.
+ */
+struct TaskstatsDelays {
+	/**
+	 * Time spent waiting on a run queue.
+	 */
+	uint_least64_t cpu = 0;
+
+	/**
+	 * Time spent waiting for synchronous block I/O.
+	 */
+	uint_least64_t blkio = 0;
+
+	/**
+	 * Time spent waiting for pages to be swapped in.
+	 */
+	uint_least64_t swapin = 0;
+};
+
+/**
+ * The final statistics of one exited thread, as sent by the kernel
+ * to exit listeners (see TaskstatsClient::SetExitListener()).
+ */
+struct TaskstatsExit {
+	unsigned pid;
+
+	/**
+	 * The thread group id; 0 if the kernel is too old to report
+	 * it (taskstats version 11 or older).
+	 */
+	unsigned tgid;
+
+	/**
+	 * CPU time [us].
+	 */
+	uint_least64_t utime, stime;
+
+	uint_least64_t minflt, majflt;
+
+	uint_least64_t voluntary_ctxt_switches, nonvoluntary_ctxt_switches;
+
+	/**
+	 * Bytes of storage I/O.
+	 */
+	uint_least64_t read_bytes, write_bytes;
+
+	/**
+	 * Time spent on the CPU [ns] and the number of timeslices
+	 * (like /proc/PID/schedstat).
+	 */
+	uint_least64_t run_real_total, cpu_count;
+
+	/**
+	 * The time spent waiting on a run queue is #delays.cpu.
+	 */
+	TaskstatsDelays delays;
+};
+
+/**
+ * Parse the attributes of a TASKSTATS_CMD_NEW message which was sent
+ * to an exit listener.
+ *
+ * @return std::nullopt if the message does not contain per-thread
+ * statistics
+ */
+[[gnu::pure]]
+std::optional<TaskstatsExit>
+ParseTaskstatsExit(std::span<const std::byte> attributes) noexcept;
+
+/**
+ * A client for the kernel's taskstats generic netlink interface.
+ * It returns binary per-process statistics, without any text
+ * parsing.  Requires CAP_NET_ADMIN.
+ */
+class TaskstatsClient {
+	UniqueFileDescriptor fd;
+
+	uint_least16_t family_id;
+
+	uint_least32_t seq = 0;
+
+public:
+	/**
+	 * Throws on error (e.g. if the kernel was built without
+	 * CONFIG_TASKSTATS or if we lack CAP_NET_ADMIN).
+	 */
+	TaskstatsClient();
+
+	/**
+	 * Query the totals of a thread group.  Throws on error.
+	 *
+	 * @return std::nullopt if the process does not exist
+	 */
+	std::optional<TaskstatsDelays> QueryTgid(unsigned tgid);
+
+	uint_least16_t GetFamilyId() const noexcept {
+		return family_id;
+	}
+
+	FileDescriptor GetFileDescriptor() const noexcept {
+		return fd;
+	}
+
+	/**
+	 * Ask the kernel to send the statistics of each exiting
+	 * thread on the given CPUs to this socket (or stop doing
+	 * so).  After registering, this object should be used only
+	 * to receive these messages.  Throws on error.
+	 *
+	 * @param cpumask a CPU list such as "0-7"
+	 */
+	void SetExitListener(const char *cpumask, bool enable);
+
+private:
+	void Send(uint_least16_t type, uint_least8_t cmd,
+		  uint_least16_t attr_type,
+		  const void *attr, std::size_t attr_size,
+		  uint_least16_t flags=0);
+
+	/**
+	 * Receive the response to the most recent request.
+	 *
+	 * @return the size of the generic netlink payload (the
+	 * attributes), which is moved to the beginning of the
+	 * buffer; 0 if the kernel responded with ESRCH or with an
+	 * acknowledgement
+	 */
+	std::size_t Receive(std::byte *buffer, std::size_t size);
+};
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "TaskstatsExitListener.hxx"
+#include "io/SmallTextFile.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringStrip.hxx"
+#include "system/Error.hxx"
+
+#include <cerrno>
+#include <exception>
+#include <span>
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+#include <sys/socket.h>
+
+/**
+ * Read the list of all CPUs which may ever be online (e.g. "0-7").
+ */
+static std::string
+ReadPossibleCpus()
+{
+	return WithSmallTextFile<256>("/sys/devices/system/cpu/possible", [](std::string_view contents){
+		return std::string{Strip(contents)};
+	});
+}
+
+TaskstatsExitListener::TaskstatsExitListener(EventLoop &event_loop,
+					     TaskstatsExitHandler &_handler)
+	:handler(_handler),
+	 cpumask(ReadPossibleCpus()),
+	 event(event_loop, BIND_THIS_METHOD(OnSocketReady))
+{
+	/* a large receive buffer reduces the risk of losing exit
+	   messages during fork storms */
+	const int rcvbuf = 4 * 1024 * 1024;
+	const int s = client.GetFileDescriptor().Get();
+	if (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	client.SetExitListener(cpumask.c_str(), true);
+
+	event.Open(client.GetFileDescriptor());
+	event.ScheduleRead();
+}
+
+TaskstatsExitListener::~TaskstatsExitListener() noexcept
+{
+	event.Cancel();
+
+	try {
+		client.SetExitListener(cpumask.c_str(), false);
+	} catch (...) {
+		/* ignore; the kernel removes listeners whose socket
+		   is gone anyway */
+	}
+}
+
+inline void
+TaskstatsExitListener::HandleMessage(const void *data, std::size_t size) noexcept
+{
+	if (size < GENL_HDRLEN)
+		return;
+
+	const auto &genl = *static_cast<const struct genlmsghdr *>(data);
+	if (genl.cmd != TASKSTATS_CMD_NEW)
+		return;
+
+	const std::span<const std::byte> attributes{
+		static_cast<const std::byte *>(data) + GENL_HDRLEN,
+		size - GENL_HDRLEN,
+	};
+
+	if (const auto e = ParseTaskstatsExit(attributes))
+		handler.OnTaskExit(*e);
+}
+
+void
+TaskstatsExitListener::OnSocketReady(unsigned) noexcept
+{
+	if (failed)
+		return;
+
+	alignas(struct nlmsghdr) std::byte buffer[16384];
+
+	while (true) {
+		const ssize_t nbytes = recv(client.GetFileDescriptor().Get(),
+					    buffer, sizeof(buffer),
+					    MSG_DONTWAIT);
+		if (nbytes < 0) {
+			if (errno == ENOBUFS)
+				/* the kernel has dropped messages; the
+				   affected processes will be accounted
+				   with the values of the last scrape */
+				continue;
+
+			if (errno != EAGAIN && errno != EINTR) {
+				PrintException(std::make_exception_ptr(MakeErrno("Failed to receive taskstats")));
+				event.Cancel();
+				failed = true;
+			}
+
+			return;
+		}
+
+		int length = nbytes;
+		for (auto *nlh = reinterpret_cast<struct nlmsghdr *>(buffer);
+		     NLMSG_OK(nlh, length); nlh = NLMSG_NEXT(nlh, length)) {
+			if (nlh->nlmsg_type != client.GetFamilyId())
+				continue;
+
+			HandleMessage(NLMSG_DATA(nlh),
+				      nlh->nlmsg_len - NLMSG_LENGTH(0));
+		}
+	}
+}
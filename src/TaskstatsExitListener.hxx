@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "Taskstats.hxx"
+#include "event/PipeEvent.hxx"
+
+#include <cstddef>
+#include <string>
+
+class TaskstatsExitHandler {
+public:
+	/**
+	 * A thread has exited; these are its final statistics.  The
+	 * message is usually handled before the process connector's
+	 * exit event, but that is not guaranteed.
+	 */
+	virtual void OnTaskExit(const TaskstatsExit &e) noexcept = 0;
+};
+
+/**
+ * Receives the statistics of all exiting threads from the kernel's
+ * taskstats interface.  Unlike /proc/PID, they are available even if
+ * the parent has already reaped the process.  This requires
+ * CAP_NET_ADMIN.
+ */
+class TaskstatsExitListener {
+	TaskstatsExitHandler &handler;
+
+	TaskstatsClient client;
+
+	/**
+	 * The CPUs we have registered for.
+	 */
+	const std::string cpumask;
+
+	PipeEvent event;
+
+	/**
+	 * Set if receiving has failed; no more messages will be
+	 * handled.
+	 */
+	bool failed = false;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	TaskstatsExitListener(EventLoop &event_loop,
+			      TaskstatsExitHandler &_handler);
+
+	~TaskstatsExitListener() noexcept;
+
+	TaskstatsExitListener(const TaskstatsExitListener &) = delete;
+	TaskstatsExitListener &operator=(const TaskstatsExitListener &) = delete;
+
+	/**
+	 * Handle all messages which are pending in the socket right
+	 * now.
+	 */
+	void Flush() noexcept {
+		OnSocketReady(0);
+	}
+
+private:
+	void HandleMessage(const void *data, std::size_t size) noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+};
@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Microbenchmarks for NumberParser.hxx, comparing with the
+ * implementations it replaces.
+ */
+
+#include "NumberParser.hxx"
+
+#include <fmt/format.h>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <span>
+#include <string_view>
+
+using std::string_view_literals::operator""sv;
+
+static constexpr unsigned ITERATIONS = 1000000;
+
+/**
+ * Call the function #ITERATIONS times and print the average time per
+ * call.
+ */
+static void
+Measure(std::string_view name, auto f)
+{
+	using Clock = std::chrono::steady_clock;
+
+	/* warm up the caches */
+	for (unsigned i = 0; i < ITERATIONS / 10; ++i)
+		f();
+
+	const auto start = Clock::now();
+	for (unsigned i = 0; i < ITERATIONS; ++i)
+		f();
+	const std::chrono::duration<double, std::nano> duration = Clock::now() - start;
+
+	fmt::print("{:<40} {:8.1f} ns\n", name, duration.count() / ITERATIONS);
+}
+
+/**
+ * The field parser before ParseUnsignedFields().
+ */
+static std::size_t
+OldParseFields(std::string_view text, std::span<uint64_t> values) noexcept
+{
+	std::size_t n = 0;
+
+	for (auto &value : values) {
+		auto [value_s, rest] = Split(StripLeft(text), ' ');
+		if (value_s.empty())
+			break;
+
+		text = StripLeft(rest);
+		value = ParseUint64(value_s);
+		++n;
+	}
+
+	return n;
+}
+
+/**
+ * The values of lines from /proc/stat, /proc/diskstats,
+ * /proc/net/dev and /proc/PID/stat (after the fields which are not
+ * numbers).
+ */
+static constexpr std::string_view field_lines[] = {
+	"4705 356 584 3699176 23060 0 1257 0 0 0"sv,
+	"115826 31318 13167918 43616 372171 314612 32766896 1318245 0 486144 1404425 0 0 0 0 39817 42563"sv,
+	"2776770   11307    0    0    0     0          0         0  2776770   11307    0    0    0     0       0          0"sv,
+	"0 0 -1 4194560 12345 67890 12 34 1234567 234567 56 78 20 0 8 0 123456789 2147483648 123456 18446744073709551615"sv,
+};
+
+static void
+BenchParseUnsignedFields()
+{
+	fmt::print("time per call, {} lines each:\n", std::size(field_lines));
+
+	volatile uint64_t sink = 0;
+
+	Measure("Split() + ParseUint64()"sv, [&sink]{
+		std::array<uint64_t, 20> values;
+		uint64_t sum = 0;
+		for (const auto i : field_lines)
+			sum += OldParseFields(i, values) + values[1];
+		sink = sink + sum;
+	});
+
+	Measure("ParseUnsignedFields()"sv, [&sink]{
+		std::array<uint64_t, 20> values;
+		uint64_t sum = 0;
+		for (auto i : field_lines)
+			sum += ParseUnsignedFields(i, values) + values[1];
+		sink = sink + sum;
+	});
+}
+
+/**
+ * The ParseDouble() implementation before std::from_chars().
+ */
+[[gnu::pure]]
+static double
+OldParseDouble(std::string_view text) noexcept
+{
+	const auto [a, b] = Split(text, '.');
+
+	return (double)ParseUint64(a) +
+		(double)ParseUint64(b) * pow(10, -(double)b.size());
+}
+
+/**
+ * Values as found in /proc/pressure/ and /proc/loadavg.
+ */
+static constexpr std::string_view double_values[] = {
+	"0.00"sv, "12.47"sv, "100.00"sv, "3.08"sv, "0.52"sv, "27.91"sv,
+};
+
+static void
+BenchParseDouble()
+{
+	fmt::print("time per call, {} values each:\n", std::size(double_values));
+
+	volatile double sink = 0;
+
+	Measure("ParseDouble() [old]"sv, [&sink]{
+		double sum = 0;
+		for (const auto i : double_values)
+			sum += OldParseDouble(i);
+		sink = sink + sum;
+	});
+
+	Measure("ParseDouble()"sv, [&sink]{
+		double sum = 0;
+		for (const auto i : double_values)
+			sum += ParseDouble(i);
+		sink = sink + sum;
+	});
+
+	Measure("strtod()"sv, [&sink]{
+		double sum = 0;
+		for (const auto i : double_values)
+			/* the literals are null-terminated */
+			sum += strtod(i.data(), nullptr);
+		sink = sink + sum;
+	});
+}
+
+int
+main() noexcept
+{
+	BenchParseUnsignedFields();
+	BenchParseDouble();
+	return EXIT_SUCCESS;
+}
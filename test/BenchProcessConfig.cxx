@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Microbenchmark for ProcessExporterConfig::MakeName() with many
+ * rules, comparing with the linear scan it replaces.
+ */
+
+#include "RandomProcessConfig.hxx"
+
+#include <chrono>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+using std::string_view_literals::operator""sv;
+
+static constexpr unsigned ITERATIONS = 100;
+
+/**
+ * Call the function #ITERATIONS times and print the average time per
+ * process.
+ */
+static void
+Measure(std::string_view name, std::size_t n_processes, auto f)
+{
+	using Clock = std::chrono::steady_clock;
+
+	/* warm up the caches */
+	f();
+
+	const auto start = Clock::now();
+	for (unsigned i = 0; i < ITERATIONS; ++i)
+		f();
+	const std::chrono::duration<double, std::nano> duration = Clock::now() - start;
+
+	fmt::print("{:<40} {:8.1f} ns\n", name,
+		   duration.count() / ITERATIONS / n_processes);
+}
+
+static void
+BenchMakeName(unsigned n_rules)
+{
+	RandomProcessConfig random{n_rules, n_rules, 200};
+
+	auto config = random.MakeConfig(n_rules, 100);
+	config.BuildIndex();
+
+	std::vector<ProcessInfo> processes;
+	for (unsigned i = 0; i < 1000; ++i)
+		processes.emplace_back(random.MakeProcess());
+
+	fmt::print("time per process, {} rules:\n", n_rules);
+
+	std::size_t sink = 0;
+
+	Measure("MakeName() [linear]"sv, processes.size(), [&]{
+		for (const auto &i : processes)
+			sink += LinearMakeName(config, i).size();
+	});
+
+	Measure("MakeName()"sv, processes.size(), [&]{
+		for (const auto &i : processes)
+			sink += config.MakeName(i).size();
+	});
+
+	/* don't let the compiler optimize the calls away */
+	if (sink == 0)
+		fmt::print("no matches\n");
+}
+
+int
+main()
+{
+	for (const unsigned n_rules : {10, 100, 300, 1000})
+		BenchMakeName(n_rules);
+
+	return EXIT_SUCCESS;
+}
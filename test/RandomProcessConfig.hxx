@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Generate random "process_names" rules and processes for the
+ * ProcessConfig test and benchmark.
+ */
+
+#pragma once
+
+#include "ProcessConfig.hxx"
+#include "ProcessInfo.hxx"
+
+#include <fmt/format.h>
+
+#include <random>
+#include <set>
+#include <string>
+
+/**
+ * The old implementation of ProcessExporterConfig::MakeName(),
+ * which evaluates all rules.
+ */
+inline std::string
+LinearMakeName(const ProcessExporterConfig &config,
+	       const ProcessInfo &info) noexcept
+{
+	for (const auto &i : config.process_names)
+		if (i.Match(info))
+			return i.MakeName(info);
+
+	return {};
+}
+
+/**
+ * The names of executables, process names and command-line options
+ * are picked from small pools, so rules and processes collide often.
+ */
+class RandomProcessConfig {
+	std::mt19937 gen{42};
+
+	unsigned n_exe, n_comm, n_options;
+
+public:
+	RandomProcessConfig(unsigned _n_exe, unsigned _n_comm,
+			    unsigned _n_options) noexcept
+		:n_exe(_n_exe), n_comm(_n_comm), n_options(_n_options) {}
+
+	/**
+	 * Generate a configuration like debian/process.yml with many
+	 * more rules.  Most rules have "exe", some of them with
+	 * "comm" and/or "cmdline"; others have only "comm".  A
+	 * quarter have no "name".  The caller must call
+	 * ProcessExporterConfig::BuildIndex().
+	 *
+	 * @param cmdline_only one in this many rules has only
+	 * "cmdline"; these need to be evaluated for every process
+	 */
+	ProcessExporterConfig MakeConfig(unsigned n_rules,
+					 unsigned cmdline_only) {
+		ProcessExporterConfig config;
+
+		for (unsigned i = 0; i < n_rules; ++i) {
+			ProcessNameConfig pn;
+
+			if (!Chance(4))
+				pn.name = fmt::format("rule{}", i);
+
+			if (Chance(cmdline_only)) {
+				AddOption(pn);
+				config.process_names.emplace_back(std::move(pn));
+				continue;
+			}
+
+			switch (Random(7)) {
+			case 0:
+			case 1:
+			case 2:
+				/* exe */
+				AddNames(pn.exe, "exe", n_exe);
+				break;
+
+			case 3:
+				/* exe and comm */
+				AddNames(pn.exe, "exe", n_exe);
+				AddNames(pn.comm, "comm", n_comm);
+				break;
+
+			case 4:
+			case 5:
+				/* comm */
+				AddNames(pn.comm, "comm", n_comm);
+				break;
+
+			case 6:
+				/* exe and cmdline, like "nodejs" or "java" */
+				AddNames(pn.exe, "exe", n_exe);
+				AddOption(pn);
+				break;
+			}
+
+			if (Chance(8))
+				AddOption(pn);
+
+			config.process_names.emplace_back(std::move(pn));
+		}
+
+		return config;
+	}
+
+	/**
+	 * Generate a process; some of its names do not appear in
+	 * any rule.
+	 */
+	ProcessInfo MakeProcess() {
+		ProcessInfo info;
+		info.exe = fmt::format("exe{}", Random(n_exe + n_exe / 4));
+		info.comm = fmt::format("comm{}", Random(n_comm + n_comm / 4));
+
+		info.cmdline = info.exe;
+		for (unsigned n = Random(4); n > 0; --n) {
+			info.cmdline.push_back(' ');
+			info.cmdline += fmt::format("--option{}", Random(n_options));
+		}
+
+		return info;
+	}
+
+private:
+	unsigned Random(unsigned n) noexcept {
+		return std::uniform_int_distribution<unsigned>{0, n - 1}(gen);
+	}
+
+	bool Chance(unsigned n) noexcept {
+		return Random(n) == 0;
+	}
+
+	void AddNames(std::set<std::string, std::less<>> &dest,
+		      const char *prefix, unsigned n) {
+		for (unsigned i = 1 + Random(3); i > 0; --i)
+			dest.emplace(fmt::format("{}{}", prefix, Random(n)));
+	}
+
+	void AddOption(ProcessNameConfig &pn) {
+		const auto pattern = fmt::format("--option{}\\b", Random(n_options));
+		pn.cmdline.emplace_front(pattern.c_str(), Pcre::CompileOptions{});
+	}
+};
@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "NumberParser.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <span>
+#include <string>
+
+using std::string_view_literals::operator""sv;
+
+TEST(NumberParser, IsEightDigits)
+{
+	if constexpr (std::endian::native != std::endian::little)
+		GTEST_SKIP() << "SWAR parsing is only used on little-endian";
+
+	using namespace NumberParserDetail;
+
+	/* replace each byte with each possible value */
+	for (std::size_t position = 0; position < 8; ++position) {
+		for (unsigned ch = 0; ch < 256; ++ch) {
+			char buffer[8];
+			std::copy_n("12345678", 8, buffer);
+			buffer[position] = static_cast<char>(ch);
+
+			EXPECT_EQ(IsEightDigits(LoadEightBytes(buffer)),
+				  ch >= '0' && ch <= '9')
+				<< "position=" << position << " ch=" << ch;
+		}
+	}
+}
+
+TEST(NumberParser, ParseEightDigits)
+{
+	if constexpr (std::endian::native != std::endian::little)
+		GTEST_SKIP() << "SWAR parsing is only used on little-endian";
+
+	using namespace NumberParserDetail;
+
+	std::mt19937 gen{42};
+	std::uniform_int_distribution<uint32_t> dist{0, 99999999};
+
+	for (unsigned i = 0; i < 100000; ++i) {
+		uint32_t expected = dist(gen);
+
+		/* include the limits and many leading zeroes */
+		if (i == 0)
+			expected = 0;
+		else if (i == 1)
+			expected = 99999999;
+		else
+			expected >>= i % 4 * 8;
+
+		char buffer[9];
+		snprintf(buffer, sizeof(buffer), "%08u", expected);
+
+		EXPECT_EQ(ParseEightDigits(LoadEightBytes(buffer)), expected) << buffer;
+	}
+}
+
+/**
+ * The reference for ParseUnsignedFields(): the Split() and
+ * ParseUint64() loop which was used before.
+ */
+static std::size_t
+ReferenceParseFields(std::string_view &text, std::span<uint64_t> values) noexcept
+{
+	std::size_t n = 0;
+
+	for (auto &value : values) {
+		auto [value_s, rest] = Split(StripLeft(text), ' ');
+		if (value_s.empty())
+			break;
+
+		text = StripLeft(rest);
+		value = ParseUint64(value_s);
+		++n;
+	}
+
+	return n;
+}
+
+static void
+ExpectParseFields(std::string_view text, std::size_t max_fields=16)
+{
+	std::array<uint64_t, 16> expected{}, actual{};
+	assert(max_fields <= expected.size());
+
+	std::string_view expected_rest = text, actual_rest = text;
+	const std::size_t expected_n =
+		ReferenceParseFields(expected_rest, std::span{expected}.first(max_fields));
+	const std::size_t actual_n =
+		ParseUnsignedFields(actual_rest, std::span{actual}.first(max_fields));
+
+	EXPECT_EQ(actual_n, expected_n) << '"' << text << '"';
+	EXPECT_EQ(actual, expected) << '"' << text << '"';
+
+	/* the caller may continue parsing after the fields */
+	EXPECT_EQ(StripLeft(actual_rest), StripLeft(expected_rest)) << '"' << text << '"';
+}
+
+TEST(NumberParser, ParseUnsignedFields)
+{
+	static constexpr std::string_view values[] = {
+		""sv, " "sv, "   "sv, "0"sv,
+
+		/* around the 8 digit SWAR step */
+		"1234567"sv, "12345678"sv, "123456789"sv,
+		"1234567812345678"sv, "12345678123456789"sv,
+		"1234567 12345678 123456789 1234567812345678"sv,
+		"00000000 00000001 099999999"sv,
+
+		/* the largest value and overflow */
+		"18446744073709551615"sv, "18446744073709551616"sv,
+		"99999999999999999999999999999999"sv,
+
+		/* negative fields, e.g. the nice value in
+		   /proc/PID/stat */
+		"-20 5"sv, "20 -20 -1"sv, "-12345678 1"sv,
+
+		/* runs of spaces, e.g. in /proc/net/dev */
+		"1  2   3    4"sv, "   7   8"sv, "1                       2"sv,
+
+		/* trailing garbage */
+		"12abc 34"sv, "12345678x 1"sv, "123456789x 1"sv,
+		"1 2\n"sv, "1 2 "sv, "1\t2 3"sv, "12345678\n"sv,
+		"1.5 2"sv,
+
+		/* like /proc/diskstats */
+		"   8       0 sda 115826 31318 13167918 43616 372171 314612 32766896 1318245 0 486144 1404425 0 0 0 0 39817 42563"sv,
+	};
+
+	for (const auto i : values)
+		ExpectParseFields(i);
+
+	/* fewer fields than available */
+	ExpectParseFields("1 2 3 4 5"sv, 3);
+	ExpectParseFields("12345678 123456789 -20"sv, 2);
+	ExpectParseFields("1 2"sv, 0);
+}
+
+/**
+ * Compare with the Split() loop on random lines made of digits,
+ * spaces and other characters.
+ */
+TEST(NumberParser, ParseUnsignedFieldsRandom)
+{
+	static constexpr char alphabet[] = "0123456789012345678901234567890123456789   -x\t\n";
+
+	std::mt19937 gen{42};
+	std::uniform_int_distribution<std::size_t> length_dist{0, 80};
+	std::uniform_int_distribution<std::size_t> char_dist{0, sizeof(alphabet) - 2};
+
+	for (unsigned i = 0; i < 100000; ++i) {
+		std::string s;
+		for (std::size_t length = length_dist(gen); length > 0; --length)
+			s.push_back(alphabet[char_dist(gen)]);
+
+		ExpectParseFields(s);
+	}
+}
+
+/**
+ * The reference for ParseDouble(): strtod(), except that
+ * ParseDouble() returns (positive) 0 for values which are out of
+ * range instead of HUGE_VAL or a signed zero.
+ */
+static double
+ReferenceParseDouble(const std::string &text) noexcept
+{
+	errno = 0;
+	const double value = strtod(text.c_str(), nullptr);
+	if (errno == ERANGE &&
+	    (std::isinf(value) || std::fpclassify(value) == FP_ZERO))
+		return 0;
+
+	return value;
+}
+
+static void
+ExpectParseDouble(const std::string &text)
+{
+	const double expected = ReferenceParseDouble(text);
+	const double actual = ParseDouble(text);
+
+	/* EXPECT_EQ() alone would accept -0 for 0 */
+	EXPECT_EQ(std::signbit(actual), std::signbit(expected)) << '"' << text << '"';
+	EXPECT_EQ(actual, expected) << '"' << text << '"';
+}
+
+TEST(NumberParser, ParseDouble)
+{
+	static constexpr const char *values[] = {
+		/* empty and invalid */
+		"", " ", "abc", "-", "+", ".", "-.e1", "+-1", "-+1", "++1", "+ 1",
+		"e5",
+
+		/* plain numbers */
+		"0", "1", "0.00", "12.47", "0.52", "1.5", "100", ".5", "5.",
+		"3.14159265358979323846",
+
+		/* signs */
+		"-0", "+0", "-1", "+1", "-0.25", "+2.5", "-.5",
+
+		/* exponents */
+		"1e3", "1E-3", "-1.5e+2", "+2.5E2", "1e", "1e+", "1e-",
+		"123456789e-5",
+
+		/* leading whitespace */
+		"  3.14", "\t2.5", " \t -7.25", "\n1",
+
+		/* trailing garbage */
+		"12.34abc", "1.5 2.5", "7\n", "1.2.3",
+
+		/* limits */
+		"1.7976931348623157e308", "2.2250738585072014e-308",
+		"4.9e-324", "1e-310",
+
+		/* out of range */
+		"1e400", "-1e400", "1.8e308", "1e-400", "-1e-400", "2e-324",
+	};
+
+	for (const char *i : values)
+		ExpectParseDouble(i);
+}
+
+/**
+ * Compare with strtod() on random decimal numbers with optional
+ * whitespace, sign, fraction and exponent.
+ */
+TEST(NumberParser, ParseDoubleRandom)
+{
+	std::mt19937 gen{42};
+
+	const auto digits = [&gen](std::string &s, unsigned max){
+		for (unsigned n = std::uniform_int_distribution{0u, max}(gen); n > 0; --n)
+			s.push_back('0' + std::uniform_int_distribution{0, 9}(gen));
+	};
+
+	const auto maybe = [&gen](){
+		return std::uniform_int_distribution{0, 1}(gen) != 0;
+	};
+
+	for (unsigned i = 0; i < 200000; ++i) {
+		std::string s;
+
+		if (maybe())
+			s.push_back(' ');
+
+		if (maybe())
+			s.push_back(maybe() ? '-' : '+');
+
+		digits(s, 20);
+
+		if (maybe()) {
+			s.push_back('.');
+			digits(s, 20);
+		}
+
+		if (maybe()) {
+			s.push_back(maybe() ? 'e' : 'E');
+			if (maybe())
+				s.push_back(maybe() ? '-' : '+');
+			digits(s, 3);
+		}
+
+		ExpectParseDouble(s);
+	}
+}
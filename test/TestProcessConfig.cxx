@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "RandomProcessConfig.hxx"
+
+#include <gtest/gtest.h>
+
+static void
+ExpectSameNames(RandomProcessConfig &random,
+		const ProcessExporterConfig &config)
+{
+	unsigned n_matches = 0;
+
+	for (unsigned i = 0; i < 20000; ++i) {
+		const auto info = random.MakeProcess();
+		const auto expected = LinearMakeName(config, info);
+
+		EXPECT_EQ(config.MakeName(info), expected)
+			<< "exe=" << info.exe << " comm=" << info.comm
+			<< " cmdline=" << info.cmdline;
+
+		if (!expected.empty())
+			++n_matches;
+	}
+
+	/* make sure both the matching and the non-matching paths
+	   were exercised */
+	EXPECT_GT(n_matches, 1000U);
+	EXPECT_LT(n_matches, 19000U);
+}
+
+/**
+ * Compare the indexed MakeName() with the linear scan over all rules.
+ */
+TEST(ProcessConfig, MakeName)
+{
+	RandomProcessConfig random{500, 500, 200};
+
+	auto config = random.MakeConfig(400, 8);
+	config.BuildIndex();
+
+	ExpectSameNames(random, config);
+}
+
+/**
+ * A rule which matches every process hides all rules after it.
+ */
+TEST(ProcessConfig, MakeNameCatchAll)
+{
+	RandomProcessConfig random{500, 500, 200};
+
+	auto config = random.MakeConfig(400, 8);
+	config.process_names.emplace(config.process_names.begin() + 200);
+	config.BuildIndex();
+
+	for (unsigned i = 0; i < 1000; ++i) {
+		const auto info = random.MakeProcess();
+		const auto name = config.MakeName(info);
+		EXPECT_EQ(name, LinearMakeName(config, info));
+		EXPECT_FALSE(name.empty());
+	}
+}
+
+TEST(ProcessConfig, MakeNameEmpty)
+{
+	RandomProcessConfig random{500, 500, 200};
+
+	ProcessExporterConfig config;
+	config.BuildIndex();
+
+	EXPECT_EQ(config.MakeName(random.MakeProcess()), "");
+}